@@ -88,14 +88,19 @@ int main(int argc, char **argv) {
     // Create an input file with arbitrary data
     read_input(X, Y, input_size);
     memcpy(Y_host, Y, input_size_dpu_8bytes * nr_of_dpus * sizeof(T));
+    verify_init(&p.verify, nr_of_dpus);
 
     // Loop over main kernel
     for(int rep = 0; rep < p.n_warmup + p.n_reps; rep++) {
 
-        // Compute output on CPU (verification purposes)
+        // Compute output on CPU (verification purposes), for the slices of the sampled DPUs only with -v sampled
         if(rep >= p.n_warmup)
             start(&timer, 0, rep - p.n_warmup);
-        axpy_host(X, Y_host, alpha, input_size);
+        for(i = 0; i < nr_of_dpus; i++) {
+            unsigned int first = input_size_dpu_8bytes * i;
+            if(verify_dpu(&p.verify, i) && first < input_size)
+                axpy_host(X + first, Y_host + first, alpha, input_size - first < input_size_dpu_8bytes ? input_size - first : input_size_dpu_8bytes);
+        }
         if(rep >= p.n_warmup)
             stop(&timer, 0);
 
@@ -250,12 +255,16 @@ int main(int argc, char **argv) {
     // Check output
     bool status = true;
     for (i = 0; i < input_size; i++) {
+        if(!verify_dpu(&p.verify, i / input_size_dpu_8bytes))
+            continue;
         if(Y_host[i] != Y[i]){ 
             status = false;
             printf("%d: %u -- %u\n", i, Y_host[i], Y[i]);
         }
     }
-    if (status) {
+    if (p.verify.mode == VERIFY_OFF) {
+        printf("[" ANSI_COLOR_YELLOW "SKIPPED" ANSI_COLOR_RESET "] Outputs not verified\n");
+    } else if (status) {
         printf("[" ANSI_COLOR_GREEN "OK" ANSI_COLOR_RESET "] Outputs are equal\n");
     } else {
         printf("[" ANSI_COLOR_RED "ERROR" ANSI_COLOR_RESET "] Outputs differ!\n");
@@ -2,12 +2,14 @@
 #define _PARAMS_H_
 
 #include "common.h"
+#include "verify.h"
 
 typedef struct Params {
     unsigned int   input_size;
     T     alpha;
     int   n_warmup;
     int   n_reps;
+    verify_t verify;
 }Params;
 
 static void usage() {
@@ -18,6 +20,7 @@ static void usage() {
         "\n    -h        help"
         "\n    -w <W>    # of untimed warmup iterations (default=0)"
         "\n    -e <E>    # of timed repetition iterations (default=1)"
+        "\n    -v <V>    verification: full, sampled[:N] (the slices of N DPUs, default=4) or off (default=full)"
         "\n"
         "\nWorkload-specific options:"
         "\n    -i <I>    input size (default=2621440 elements)"
@@ -31,9 +34,10 @@ struct Params input_params(int argc, char **argv) {
     p.alpha         = 100;
     p.n_warmup      = 0;
     p.n_reps        = 1;
+    verify_parse(&p.verify, "full");
 
     int opt;
-    while((opt = getopt(argc, argv, "hi:a:w:e:")) >= 0) {
+    while((opt = getopt(argc, argv, "hi:a:w:e:v:")) >= 0) {
         switch(opt) {
         case 'h':
         usage();
@@ -43,6 +47,13 @@ struct Params input_params(int argc, char **argv) {
         case 'a': p.alpha         = atoi(optarg); break;
         case 'w': p.n_warmup      = atoi(optarg); break;
         case 'e': p.n_reps        = atoi(optarg); break;
+        case 'v':
+            if(verify_parse(&p.verify, optarg)) {
+                fprintf(stderr, "\nInvalid verification mode %s!\n", optarg);
+                usage();
+                exit(0);
+            }
+            break;
         default:
             fprintf(stderr, "\nUnrecognized option!\n");
             usage();
@@ -9,26 +9,54 @@
 #include <alloc.h>
 #include <perfcounter.h>
 #include <barrier.h>
+#include <mutex.h>
 
 #include "../support/common.h"
 #include "../support/cyclecount.h"
+#include "../support/sched.h"
+#include "../support/packing.h"
+#include "../support/device_gen.h"
+#include "../support/csd.h"
+#include "../support/requant.h"
+#include "../support/mram_layout.h"
 
 // Input and output arguments
 __host dpu_arguments_t DPU_INPUT_ARGUMENTS;
 __host dpu_results_t DPU_RESULTS[NR_TASKLETS];
+__host uint16_t CSD_DIGITS[CSD_TABLE_SIZE]; // Weight bytes in CSD form, recoded by the host
+__host mram_layout_t MRAM_LAYOUT; // Tensor table, pushed once by the host
 
 // Barrier
 BARRIER_INIT(my_barrier, NR_TASKLETS);
+// Read-modify-write of the channel accumulators in MRAM (-n)
+MUTEX_INIT(channel_mutex);
 
 extern int main_kernel1(void);
-int (*kernels[nr_kernels])(void) = {main_kernel1};
+extern int main_kernel2(void);
+extern int main_kernel3(void);
+extern int main_kernel4(void);
+extern int main_kernel5(void);
+int (*kernels[nr_kernels])(void) = {main_kernel1, main_kernel2, main_kernel3, main_kernel4, main_kernel5};
+extern int generate_operands(void);
 int main(void) { 
+    // Device generation (-d), once before the first kernel
+    if(DPU_INPUT_ARGUMENTS.generate)
+        return generate_operands();
     // Kernel
     return kernels[DPU_INPUT_ARGUMENTS.kernel](); 
 }
 
+// Dot product of one cached block, added to *res. scratch is a per-tasklet WRAM buffer
+// Operands are unsigned or two's complement as given by signed_x and signed_w in DPU_INPUT_ARGUMENTS
+typedef void (*block_dp_t)(uint8_t* A, uint8_t* B, int32_t* res, unsigned int nr_elements, uint32_t* scratch);
+
 // kernel: Computes bitwise dp for the cached blocks
-static void bitwise_dp(uint8_t* A, uint8_t* B, uint32_t* res, unsigned int nr_elements) {
+static void bitwise_dp(uint8_t* A, uint8_t* B, int32_t* res, unsigned int nr_elements, uint32_t* scratch) {
+    (void)scratch;
+    // bit planes weighing -2^7 (8 never matches for unsigned operands)
+    int neg_p = DPU_INPUT_ARGUMENTS.signed_x ? 7 : 8;
+    int neg_q = DPU_INPUT_ARGUMENTS.signed_w ? 7 : 8;
+    uint32_t acc[2] = {0, 0}; // acc[1] collects the products of one negated bit plane
     for (unsigned int i=0; i < nr_elements; i++) {
         uint8_t a = A[i];
         uint8_t b = B[i];
@@ -36,23 +64,175 @@ static void bitwise_dp(uint8_t* A, uint8_t* B, uint32_t* res, unsigned int nr_el
             uint8_t bit_a = (a >> p) & 1;
             for(int q=0;q<8;q++) {
                 uint8_t bit_b = (b >> q) & 1;
-                *res += (bit_a & bit_b) << (p + q);
+                acc[(p == neg_p) ^ (q == neg_q)] += (bit_a & bit_b) << (p + q);
             }
         }
     }
+    *res += (int32_t)(acc[0] - acc[1]);
+}
+
+// kernel: Computes the dp for the cached blocks with the native 8x8-bit multiply
+static void native_dp(uint8_t* A, uint8_t* B, int32_t* res, unsigned int nr_elements, uint32_t* scratch) {
+    (void)scratch;
+    int32_t sum = 0;
+    // one loop per encoding, so that each is a plain 8x8-bit multiply
+    if (!DPU_INPUT_ARGUMENTS.signed_x && !DPU_INPUT_ARGUMENTS.signed_w) {
+        for (unsigned int i=0; i < nr_elements; i++)
+            sum += (uint16_t)(A[i] * B[i]);
+    } else if (!DPU_INPUT_ARGUMENTS.signed_x) {
+        for (unsigned int i=0; i < nr_elements; i++)
+            sum += (int16_t)(A[i] * (int8_t)B[i]);
+    } else if (!DPU_INPUT_ARGUMENTS.signed_w) {
+        for (unsigned int i=0; i < nr_elements; i++)
+            sum += (int16_t)((int8_t)A[i] * B[i]);
+    } else {
+        for (unsigned int i=0; i < nr_elements; i++)
+            sum += (int16_t)((int8_t)A[i] * (int8_t)B[i]);
+    }
+    *res += sum;
 }
 
-static uint32_t res_array[NR_TASKLETS];
+// kernel: Computes the dp for the cached blocks from a joint histogram of nibble pairs
+// x * w = 256 * xh * wh + 16 * (xh * wl + xl * wh) + xl * wl, so every element adds the weights of its
+// four nibble pairs to the 16x16 histogram, and the block sum is the histogram weighted by the pair products
+// Signed operands are offset to unsigned (x ^ 0x80 = x + 128), and the offsets are removed from the block sum:
+// x * w = xu * wu - 128 * (sx * wu + sw * xu) + 128 * 128 * sx * sw
+#define HISTOGRAM_BYTES (256 * sizeof(uint32_t))
+static void histogram_dp(uint8_t* A, uint8_t* B, int32_t* res, unsigned int nr_elements, uint32_t* histogram) {
+    uint8_t offset_x = DPU_INPUT_ARGUMENTS.signed_x ? 0x80 : 0;
+    uint8_t offset_w = DPU_INPUT_ARGUMENTS.signed_w ? 0x80 : 0;
+    uint32_t sum_x = 0, sum_w = 0; // sums of the offset operands
+    for (unsigned int j=0; j < 256; j++) {
+        histogram[j] = 0;
+    }
+    for (unsigned int i=0; i < nr_elements; i++) {
+        uint8_t a = A[i] ^ offset_x;
+        uint8_t b = B[i] ^ offset_w;
+        sum_x += a;
+        sum_w += b;
+        uint8_t a_hi = a & 0xF0, a_lo = a << 4; // x nibble as the row index
+        uint8_t b_hi = b >> 4, b_lo = b & 0x0F;
+        histogram[a_hi | b_hi] += 256;
+        histogram[a_hi | b_lo] += 16;
+        histogram[a_lo | b_hi] += 16;
+        histogram[a_lo | b_lo] += 1;
+    }
+    uint32_t sum = 0;
+    for (unsigned int j=0; j < 256; j++) {
+        if (histogram[j])
+            sum += histogram[j] * (uint8_t)((j >> 4) * (j & 0x0F));
+    }
+    int32_t correction = -(int32_t)(offset_w * sum_x) - (int32_t)(offset_x * sum_w) + (int32_t)(offset_x * offset_w * nr_elements);
+    *res += (int32_t)sum + correction;
+}
 
+// kernel: Computes the dp for the cached blocks by shift-add over the non-zero CSD digits of the weights
+// x * w = sum of +-(x << q) over the digits of w (support/csd.h)
+static void csd_dp(uint8_t* A, uint8_t* B, int32_t* res, unsigned int nr_elements, uint32_t* scratch) {
+    (void)scratch;
+    int32_t offset_x = DPU_INPUT_ARGUMENTS.signed_x ? 0x80 : 0; // (a ^ 0x80) - 0x80 sign-extends a
+    uint32_t carry_min = DPU_INPUT_ARGUMENTS.signed_w ? CSD_TABLE_SIZE : CSD_MAX_8_DIGITS + 1; // weights with a digit at plane 8
+    uint32_t sum = 0; // two's complement, shifts of negative activations stay defined
+    for (unsigned int i=0; i < nr_elements; i++) {
+        uint32_t x = (uint32_t)((A[i] ^ offset_x) - offset_x);
+        uint8_t b = B[i];
+        uint32_t digits = CSD_DIGITS[b];
+        for (uint32_t pos = digits & 0xff; pos; pos &= pos - 1)
+            sum += x << (31 - __builtin_clz(pos & -pos));
+        for (uint32_t neg = digits >> 8; neg; neg &= neg - 1)
+            sum -= x << (31 - __builtin_clz(neg & -neg));
+        if (b >= carry_min)
+            sum += x << 8;
+    }
+    *res += (int32_t)sum;
+}
 
-// main_kernel1
-int main_kernel1() {
+// kernel: Computes the dp of packed 1-bit elements (-b 1), 32 per AND or XOR and popcount (cao)
+// Unsigned elements are 0/1: x * w = x & w. Signed ones are -1/+1, set for +1, so x * w = +1 where the
+// bits agree: sum = n - 2 * popcount(x ^ w). Mixed: sum = 2 * popcount(x & w) - popcount(the 0/1 operand)
+static void binary_dp(uint8_t* A, uint8_t* B, int32_t* res, unsigned int nr_elements, uint32_t* scratch) {
+    (void)scratch;
+    const uint32_t *a = (const uint32_t *)A, *b = (const uint32_t *)B;
+    unsigned int words = nr_elements >> 5;
+    uint32_t sum = 0;
+    if (!DPU_INPUT_ARGUMENTS.signed_x && !DPU_INPUT_ARGUMENTS.signed_w) {
+        for (unsigned int i=0; i < words; i++)
+            sum += __builtin_popcount(a[i] & b[i]);
+        *res += (int32_t)sum;
+    } else if (DPU_INPUT_ARGUMENTS.signed_x && DPU_INPUT_ARGUMENTS.signed_w) {
+        for (unsigned int i=0; i < words; i++)
+            sum += __builtin_popcount(a[i] ^ b[i]);
+        *res += (int32_t)nr_elements - 2 * (int32_t)sum;
+    } else {
+        const uint32_t *u = DPU_INPUT_ARGUMENTS.signed_x ? b : a;
+        uint32_t sum_u = 0;
+        for (unsigned int i=0; i < words; i++) {
+            sum += __builtin_popcount(a[i] & b[i]);
+            sum_u += __builtin_popcount(u[i]);
+        }
+        *res += 2 * (int32_t)sum - (int32_t)sum_u;
+    }
+}
+
+static int64_t res_array[NR_TASKLETS];
+
+// Weight scale of a group, read with the 7 that follow it since MRAM reads are 8-byte aligned
+static uint8_t read_group_scale(uint32_t mram_base_addr_scales, uint32_t group, uint8_t scales[8], uint32_t *cached) {
+    if((group & ~7) != *cached) {
+        *cached = group & ~7;
+        mram_read((__mram_ptr void const*)(mram_base_addr_scales + *cached), scales, 8);
+    }
+    return scales[group & 7];
+}
+
+// Adds the partial sum of a channel to its accumulator in MRAM, which tasklets with blocks of the same channel share
+static void channel_add(uint32_t mram_base_addr_acc, uint32_t channel, int64_t partial) {
+    int64_t acc;
+    mutex_lock(channel_mutex);
+    mram_read((__mram_ptr void const*)(mram_base_addr_acc + channel * sizeof(int64_t)), &acc, sizeof(acc));
+    acc += partial;
+    mram_write(&acc, (__mram_ptr void*)(mram_base_addr_acc + channel * sizeof(int64_t)), sizeof(acc));
+    mutex_unlock(channel_mutex);
+}
+
+// Fused epilogue (-u): requantizes the channel accumulators REQUANT_CHANNELS at a time, the steps round-robin over
+// the tasklets, and writes the outputs (support/requant.h). cache_X holds the requant_t of a step, cache_Y its
+// accumulators and then its outputs
+static void requant_epilogue(unsigned int tasklet_id, uint32_t nr_channels, uint8_t *cache_X, uint8_t *cache_Y) {
+    uint32_t bits = DPU_INPUT_ARGUMENTS.requant_bits;
+    uint32_t mram_base_addr_channels = mram_tensor(&MRAM_LAYOUT, TENSOR_REQUANT);
+    uint32_t mram_base_addr_acc = mram_tensor(&MRAM_LAYOUT, TENSOR_CHANNEL_ACC);
+    uint32_t mram_base_addr_out = mram_tensor(&MRAM_LAYOUT, TENSOR_OUTPUT);
+    requant_t *params = (requant_t *)cache_X;
+    int64_t *acc = (int64_t *)cache_Y;
+    uint8_t *out = cache_Y + REQUANT_CHANNELS * sizeof(int64_t);
+    for(uint32_t step = tasklet_id; step * REQUANT_CHANNELS < nr_channels; step += NR_TASKLETS) {
+        mram_read((__mram_ptr void const*)(mram_base_addr_channels + step * REQUANT_CHANNELS * sizeof(requant_t)), params, REQUANT_CHANNELS * sizeof(requant_t));
+        mram_read((__mram_ptr void const*)(mram_base_addr_acc + step * REQUANT_CHANNELS * sizeof(int64_t)), acc, REQUANT_CHANNELS * sizeof(int64_t));
+        for(uint32_t c = 0; c < REQUANT_CHANNELS; c++)
+            out[c] = (uint8_t)requantize(acc[c], &params[c], bits, DPU_INPUT_ARGUMENTS.relu);
+        if(bits < 8)
+            pack_elements(out, out, REQUANT_CHANNELS, bits); // in place, like the device generator
+        mram_write(out, (__mram_ptr void*)(mram_base_addr_out + step * REQUANT_OUTPUT_BYTES(REQUANT_CHANNELS, bits)), REQUANT_OUTPUT_BYTES(REQUANT_CHANNELS, bits));
+    }
+}
+
+// Block loop shared by the exact kernels
+static int dp_kernel(block_dp_t block_dp, unsigned int scratch_bytes) {
     unsigned int tasklet_id = me();
 #if PRINT
     printf("tasklet_id = %u\n", tasklet_id);
 #endif
     if (tasklet_id == 0){ 
         mem_reset(); // Reset the heap
+        sched_init(); // Reset the block distribution
+        // Zero the channel accumulators before any tasklet adds to them
+        if(DPU_INPUT_ARGUMENTS.channel_size) {
+            static int64_t zeros[REQUANT_CHANNELS];
+            uint32_t mram_base_addr_acc = mram_tensor(&MRAM_LAYOUT, TENSOR_CHANNEL_ACC);
+            for(uint32_t offset = 0; offset < MRAM_LAYOUT.tensors[TENSOR_CHANNEL_ACC].size; offset += sizeof(zeros))
+                mram_write(zeros, (__mram_ptr void*)(mram_base_addr_acc + offset), sizeof(zeros));
+        }
 #ifdef CYCLES
         perfcounter_config(COUNT_CYCLES, true); // Initialize once the cycle counter
 #elif INSTRUCTIONS
@@ -64,54 +244,117 @@ int main_kernel1() {
 #if defined(CYCLES) || defined(INSTRUCTIONS)
     perfcounter_count count;
     dpu_results_t *result = &DPU_RESULTS[tasklet_id];
-    result->count = 0;
+    if(DPU_INPUT_ARGUMENTS.wave == 0) result->count = 0; // Streamed waves accumulate their counts
     counter_start(&count); // START TIMER
 #endif
 
-    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size; // Input size per DPU in bytes
-    uint32_t input_size_dpu_bytes_transfer = DPU_INPUT_ARGUMENTS.transfer_size; // Transfer input size per DPU in bytes
+    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size; // Input size per DPU in bytes (elements when packed)
 
 
-    // Address of the current processing block in MRAM
-    uint32_t base_tasklet = tasklet_id << BLOCK_SIZE_LOG2;
-    uint32_t mram_base_addr_X = (uint32_t)DPU_MRAM_HEAP_POINTER;
-    uint32_t mram_base_addr_Y = (uint32_t)(DPU_MRAM_HEAP_POINTER + input_size_dpu_bytes_transfer);
-    uint32_t mram_base_addr_res = (uint32_t)(DPU_MRAM_HEAP_POINTER + 2*input_size_dpu_bytes_transfer);
+    // Address of the current processing block in MRAM, from the tensor table
+    uint32_t mram_base_addr_X = mram_tensor(&MRAM_LAYOUT, TENSOR_X);
+    uint32_t mram_base_addr_Y = mram_tensor(&MRAM_LAYOUT, TENSOR_W);
+    uint32_t mram_base_addr_res = mram_tensor(&MRAM_LAYOUT, TENSOR_RESULT);
+    uint32_t mram_base_addr_scales = mram_tensor(&MRAM_LAYOUT, TENSOR_SCALES);
+    uint32_t bits = DPU_INPUT_ARGUMENTS.bits;
+    uint32_t group_size = DPU_INPUT_ARGUMENTS.group_size;
+    uint8_t scales[8] __attribute__((aligned(8)));
+    uint32_t cached_scales = UINT32_MAX;
+    // Output channels: the segments of a block stop at channel boundaries, and a tasklet adds its partial sum
+    // of a channel to the channel's accumulator once it moves on to another channel
+    uint32_t channel_size = DPU_INPUT_ARGUMENTS.channel_size;
+    uint32_t mram_base_addr_acc = mram_tensor(&MRAM_LAYOUT, TENSOR_CHANNEL_ACC);
+    uint32_t channel = UINT32_MAX;
+    int64_t channel_res = 0;
 
     // Initialize a local cache in WRAM to store the MRAM block
 	uint8_t *cache_X = (uint8_t *) mem_alloc(BLOCK_SIZE);
     uint8_t *cache_Y = (uint8_t *) mem_alloc(BLOCK_SIZE);
+    uint32_t *scratch = scratch_bytes ? (uint32_t *) mem_alloc(scratch_bytes) : NULL;
 
-    uint32_t res = 0;
+    int64_t res = 0;
 
-    for(unsigned int byte_index = base_tasklet; byte_index < input_size_dpu_bytes; byte_index += BLOCK_SIZE * NR_TASKLETS){
+    // 1-bit elements stay packed: the blocks are BLOCK_SIZE packed bytes, 8 * BLOCK_SIZE elements
+    if(bits == 1)
+        input_size_dpu_bytes = PACKED_BYTES(input_size_dpu_bytes, 1);
+
+    for(uint32_t byte_index = sched_first(tasklet_id, input_size_dpu_bytes); byte_index < input_size_dpu_bytes; byte_index = sched_next(tasklet_id, byte_index)){
         // Bound checking
         //Since there are potentially a tasklet that operates on less than one data_block size
         uint32_t l_size_bytes = (byte_index + BLOCK_SIZE >= input_size_dpu_bytes) ? (input_size_dpu_bytes - byte_index) : BLOCK_SIZE;
 
+        if(bits == 1) {
+            mram_read((__mram_ptr void const*)(mram_base_addr_X + byte_index), cache_X, l_size_bytes);
+            mram_read((__mram_ptr void const*)(mram_base_addr_Y + byte_index), cache_Y, l_size_bytes);
+            int32_t block_res = 0;
+            block_dp(cache_X, cache_Y, &block_res, l_size_bytes * 8, scratch);
+            res += block_res;
+            continue;
+        }
+
         // Load cache with current MRAM block
         // MRAM-WRAM TRANSFERS 
-        mram_read((__mram_ptr void const*)(mram_base_addr_X + byte_index), cache_X, l_size_bytes);
-        mram_read((__mram_ptr void const*)(mram_base_addr_Y + byte_index), cache_Y, l_size_bytes);
+        // packed elements land at the end of the cache and are unpacked in place
+        uint32_t packed_bytes = PACKED_BYTES(l_size_bytes, bits);
+        mram_read((__mram_ptr void const*)(mram_base_addr_X + PACKED_BYTES(byte_index, bits)), cache_X + l_size_bytes - packed_bytes, packed_bytes);
+        mram_read((__mram_ptr void const*)(mram_base_addr_Y + PACKED_BYTES(byte_index, bits)), cache_Y + l_size_bytes - packed_bytes, packed_bytes);
+        unpack_block(cache_X, l_size_bytes, bits, DPU_INPUT_ARGUMENTS.signed_x);
+        unpack_block(cache_Y, l_size_bytes, bits, DPU_INPUT_ARGUMENTS.signed_w);
 
-        // compute dp
-        bitwise_dp(cache_X,cache_Y, &res, l_size_bytes);
+        // compute dp, one scale group at a time. Channels hold whole groups
+        uint32_t group_bytes = group_size && group_size < l_size_bytes ? group_size : l_size_bytes;
+        for(uint32_t offset = 0, segment_bytes; offset < l_size_bytes; offset += segment_bytes) {
+            segment_bytes = l_size_bytes - offset < group_bytes ? l_size_bytes - offset : group_bytes;
+            if(channel_size) {
+                uint32_t segment_channel = (byte_index + offset) / channel_size;
+                uint32_t channel_end = (segment_channel + 1) * channel_size - byte_index;
+                if(offset + segment_bytes > channel_end)
+                    segment_bytes = channel_end - offset;
+                if(segment_channel != channel) {
+                    if(channel != UINT32_MAX)
+                        channel_add(mram_base_addr_acc, channel, channel_res);
+                    channel = segment_channel;
+                    channel_res = 0;
+                }
+            }
+            // a block sum fits in 32 bits, the running sum of a full MRAM wave does not
+            int32_t block_res = 0;
+            block_dp(cache_X + offset, cache_Y + offset, &block_res, segment_bytes, scratch);
+            int64_t segment_res = group_size ? (int64_t)block_res * read_group_scale(mram_base_addr_scales, (byte_index + offset) / group_size, scales, &cached_scales) : block_res;
+            res += segment_res;
+            channel_res += segment_res;
+        }
 
     }
 
 
+    if(channel != UINT32_MAX)
+        channel_add(mram_base_addr_acc, channel, channel_res);
+
     // for each tasklets hold it;
     res_array[tasklet_id] = res;
 
     barrier_wait(&my_barrier);
     if(tasklet_id == 0) {
-        uint32_t total = 0;
+        int64_t total = 0;
         for(int t =0; t < NR_TASKLETS; t++) {
             total += res_array[t];
         }
-        uint64_t padded_res = total;
+        // -zw * sum(x) - zx * sum(w) + N * zx * zw, computed on the host from the bit statistics
+        if(DPU_INPUT_ARGUMENTS.dpu_rank == 0 && DPU_INPUT_ARGUMENTS.last_wave)
+            total += DPU_INPUT_ARGUMENTS.zero_point_correction;
+        int64_t padded_res = total;
+        // running accumulator across streamed waves
+        if(DPU_INPUT_ARGUMENTS.wave > 0) {
+            int64_t acc;
+            mram_read((__mram_ptr void const*)(mram_base_addr_res), &acc, sizeof(acc));
+            padded_res += acc;
+        }
         mram_write(&padded_res, (__mram_ptr void*)(mram_base_addr_res), sizeof(padded_res));
     }
+    // the accumulators are complete after the barrier
+    if(channel_size && DPU_INPUT_ARGUMENTS.requant_bits)
+        requant_epilogue(tasklet_id, input_size_dpu_bytes / channel_size, cache_X, cache_Y);
 
 
 
@@ -121,3 +364,55 @@ int main_kernel1() {
 	
     return 0;
 }
+
+// main_kernel1: bit-serial products
+int main_kernel1() {
+    return dp_kernel(bitwise_dp, 0);
+}
+
+// main_kernel2: native multiply
+int main_kernel2() {
+    return dp_kernel(native_dp, 0);
+}
+
+// main_kernel3: joint-nibble histogram
+int main_kernel3() {
+    return dp_kernel(histogram_dp, HISTOGRAM_BYTES);
+}
+
+// main_kernel4: shift-add over CSD weights
+int main_kernel4() {
+    return dp_kernel(csd_dp, 0);
+}
+
+// main_kernel5: AND/XNOR popcount over 1-bit elements
+int main_kernel5() {
+    return dp_kernel(binary_dp, 0);
+}
+
+// generate_operands: fills the slices of X and W in MRAM from the device generator (support/device_gen.h),
+// packed like the host's transfers
+int generate_operands() {
+    unsigned int tasklet_id = me();
+    if (tasklet_id == 0)
+        mem_reset(); // Reset the heap
+    barrier_wait(&my_barrier);
+
+    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size;
+    uint32_t bits = DPU_INPUT_ARGUMENTS.bits;
+    const device_gen_t *gen = &DPU_INPUT_ARGUMENTS.gen;
+    uint8_t *cache = (uint8_t *) mem_alloc(BLOCK_SIZE);
+
+    for(uint32_t operand = 0; operand < 2; operand++) {
+        uint32_t mram_base_addr = mram_tensor(&MRAM_LAYOUT, operand ? TENSOR_W : TENSOR_X);
+        uint32_t is_signed = operand ? DPU_INPUT_ARGUMENTS.signed_w : DPU_INPUT_ARGUMENTS.signed_x;
+        for(uint32_t byte_index = tasklet_id << BLOCK_SIZE_LOG2; byte_index < input_size_dpu_bytes; byte_index += BLOCK_SIZE * NR_TASKLETS) {
+            uint32_t l_size_bytes = (byte_index + BLOCK_SIZE >= input_size_dpu_bytes) ? (input_size_dpu_bytes - byte_index) : BLOCK_SIZE;
+            device_generate(gen, operand, bits, is_signed, gen->first + byte_index, l_size_bytes, cache);
+            if(bits < 8)
+                pack_elements(cache, cache, l_size_bytes, bits); // in place, every byte is read before it is overwritten
+            mram_write(cache, (__mram_ptr void*)(mram_base_addr + PACKED_BYTES(byte_index, bits)), PACKED_BYTES(l_size_bytes, bits));
+        }
+    }
+    return 0;
+}
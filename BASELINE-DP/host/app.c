@@ -16,6 +16,13 @@
 #include "../support/common.h"
 #include "../support/timer.h"
 #include "../support/params.h"
+#include "../support/tensor_file.h"
+#include "../support/generators.h"
+#include "../support/packing.h"
+#include "../support/csd.h"
+#include "../support/requant.h"
+#include "../support/mram_layout.h"
+#include "../support/stream.h"
 
 // Define the DPU Binary path as DPU_BINARY here
 #ifndef DPU_BINARY
@@ -25,33 +32,20 @@
 // Pointer declaration
 static uint8_t* X;
 static uint8_t* Y;
-static uint32_t* Y_host;
-static uint32_t res = 0;
-
-// Create input arrays
-static void read_input(uint8_t* A, uint8_t* B, unsigned int nr_elements) {
-    srand(0);
-    printf("nr_elements\t%u\n", nr_elements);
-    for (unsigned int i = 0; i < nr_elements; i++) {
-        A[i] = (uint8_t) (rand() % 2);
-        B[i] = (uint8_t) (rand() % 2);
-    }
-}
+static int64_t* Y_host;
+static int64_t res = 0;
 
 // Compute output in the host for verification purposes
-   static void bitwise_dp(uint8_t* A, uint8_t* B, uint32_t* res, unsigned int nr_elements) {
-            for (unsigned int i=0; i < nr_elements; i++) {
-                uint8_t a = A[i];
-                uint8_t b = B[i];
-                for(int p=0;p<8;p++) {
-                    uint8_t bit_a = (a >> p) & 1;
-                    for(int q=0;q<8;q++) {
-                        uint8_t bit_b = (b >> q) & 1;
-                        *res += (bit_a & bit_b) << (p + q);
-                    }
-                }
-            }
-        }
+// sum (x - zx) * (w - zw) over the real elements, with x and w unsigned or two's complement,
+// weighted by the scale of the group of each element (first is the global index of A[0])
+static void reference_dp(const uint8_t* A, const uint8_t* B, int64_t* res, uint64_t nr_elements, uint64_t first, const struct Params* p) {
+    for (uint64_t i=0; i < nr_elements; i++) {
+        int32_t x = p->signed_x ? (int8_t)A[i] : A[i];
+        int32_t w = p->signed_w ? (int8_t)B[i] : B[i];
+        int64_t scale = p->group_size ? group_scale((first + i) / p->group_size) : 1;
+        *res += (int64_t)(x - p->zero_point_x) * (w - p->zero_point_w) * scale;
+    }
+}
 
 // Main of the Host Application
 int main(int argc, char **argv) {
@@ -69,105 +63,413 @@ int main(int argc, char **argv) {
     // Allocate DPUs
     struct dpu_set_t dpu_set, dpu;
     uint32_t nr_of_dpus;
+    unsigned int i = 0;
     DPU_ASSERT(dpu_alloc(NR_DPUS, NULL, &dpu_set));
     DPU_ASSERT(dpu_get_nr_dpus(dpu_set, &nr_of_dpus)); // Number of DPUs in the DPU set
     printf("Allocated %d DPU(s)\t", nr_of_dpus);
-    printf("NR_TASKLETS\t%d\tBLOCK\t%d\n", NR_TASKLETS, BLOCK);
+    printf("NR_TASKLETS\t%d\tBLOCK\t%d\tkernel\t%u\n", NR_TASKLETS, BLOCK, p.kernel);
 
     // Load binary
     DPU_ASSERT(dpu_load(dpu_set, DPU_BINARY, NULL));
 
+    // Pre-sharded input tensors are mapped, their sharding replaces -i and -s
+    tensor_file_t input_file, output_file;
+    if(p.input_file) {
+        if(tensor_file_open(&input_file, p.input_file) != 0)
+            exit(-1);
+        if(input_file.header.nr_dpus != nr_of_dpus) {
+            fprintf(stderr, "%s is sharded for %u DPUs, %u are allocated\n", p.input_file, input_file.header.nr_dpus, nr_of_dpus);
+            exit(-1);
+        }
+        p.input_size = input_file.header.nr_elements;
+        p.wave_size = input_file.header.wave_size_dpu;
+        p.signed_x = input_file.header.signed_x;
+        p.signed_w = input_file.header.signed_w;
+        p.zero_point_x = input_file.header.zero_point_x;
+        p.zero_point_w = input_file.header.zero_point_w;
+        p.bits = input_file.header.bits ? input_file.header.bits : 8;
+        p.group_size = input_file.header.group_size;
+    }
+
+    // Only the binary kernel reads the packed 1-bit elements, whose blocks do not split into scale groups
+    if((p.kernel == kernel5) != (p.bits == 1) || (p.bits == 1 && p.group_size)) {
+        fprintf(stderr, "The binary kernel (-k 4) takes 1-bit elements (-b 1), without scale groups\n");
+        exit(-1);
+    }
+
+    // Input generator, unless the tensors come from a file
+    generator_t gen = {0};
+    if(!p.input_file && generator_init(&gen, p.generator, p.gen_param, p.dump_x, p.dump_w) != 0)
+        exit(-1);
+    generator_set_format(&gen, p.bits, p.signed_x, p.signed_w);
+    // Device generation: the DPUs generate the operands, the host the same ones for its reference
+    const bool device = p.device_seed >= 0;
+    if(device && p.input_file) {
+        fprintf(stderr, "Device generation replaces the input file\n");
+        exit(-1);
+    }
+    if(device && generator_set_device(&gen, p.device_seed, p.input_size) != 0)
+        exit(-1);
+
     // Input size 
-    const unsigned int input_size = p.input_size; // Total input size 
-    const unsigned int input_size_8bytes = 
-        ((input_size * sizeof(uint8_t)) % 8) != 0 ? roundup(input_size, 8) : input_size; // Total input size, 8-byte aligned
-    const unsigned int input_size_dpu = divceil(input_size, nr_of_dpus); // Input size per DPU (max.)
+    const uint64_t input_size = p.input_size; // Total input size 
+    // Input size per DPU and wave (max.), 8-byte aligned. Inputs larger than the MRAM are streamed in waves
+    unsigned int wave_size_dpu = p.wave_size;
+    const unsigned int max_wave_size = max_wave_size_dpu(p.bits, p.group_size);
+    if(wave_size_dpu == 0) {
+        uint64_t input_size_dpu = divceil(input_size, nr_of_dpus);
+        wave_size_dpu = input_size_dpu > max_wave_size ? max_wave_size : (unsigned int)input_size_dpu;
+    } else if(wave_size_dpu > max_wave_size) {
+        fprintf(stderr, "Waves hold at most %u elements per DPU\n", max_wave_size);
+        exit(-1);
+    }
+    // Packed slices stay 8-byte aligned and hold whole scale groups
+    const unsigned int align = packed_alignment(p.bits, p.group_size);
+    if(p.input_file && wave_size_dpu % align) {
+        fprintf(stderr, "%s has waves of %u elements per DPU, not a multiple of %u\n", p.input_file, wave_size_dpu, align);
+        exit(-1);
+    }
+    // Output channels (-n): every DPU takes whole channels, so that it has their complete accumulators and
+    // requantizes them itself (support/requant.h). Their zero-point terms would be per channel and per input
+    const unsigned int channel_size = p.channels ? (unsigned int)(input_size / p.channels) : 0;
+    const unsigned int channels_dpu = p.channels ? divceil(p.channels, nr_of_dpus) : 0; // Channels per DPU (max.)
+    if(p.channels) {
+        if(input_size % p.channels || channel_size % align || (uint64_t)channels_dpu * channel_size > max_wave_size || p.wave_size ||
+           p.zero_point_x || p.zero_point_w || p.kernel == kernel5 || p.input_file) {
+            fprintf(stderr, "Output channels need the input in one wave of whole channels, a multiple of %u elements each, "
+                "without zero-points, the binary kernel or an input file\n", align);
+            exit(-1);
+        }
+        if(BLOCK_SIZE < REQUANT_MIN_BLOCK_SIZE) {
+            fprintf(stderr, "Output channels need blocks of at least %u bytes, build with BLOCK >= 8\n", (unsigned int)REQUANT_MIN_BLOCK_SIZE);
+            exit(-1);
+        }
+        wave_size_dpu = channels_dpu * channel_size;
+    }
     const unsigned int input_size_dpu_8bytes = 
-        ((input_size_dpu * sizeof(uint8_t)) % 8) != 0 ? roundup(input_size_dpu, 8) : input_size_dpu; // Input size per DPU (max.), 8-byte aligned
+        (wave_size_dpu % align) != 0 ? roundup(wave_size_dpu, align) : wave_size_dpu; // Input size per DPU (max.), aligned
+    const unsigned int transfer_size_dpu = PACKED_BYTES(input_size_dpu_8bytes, p.bits); // Bytes per operand in MRAM
+    const unsigned int scales_size_dpu = p.group_size ? (input_size_dpu_8bytes / p.group_size + 7) & ~7 : 0; // Bytes of weight scales in MRAM
+    const uint64_t wave_size = (uint64_t)input_size_dpu_8bytes * nr_of_dpus; // Elements per wave over all DPUs
+    const unsigned int nr_waves = divceil(input_size, wave_size);
+    const bool streaming = nr_waves > 1;
+    if(device && streaming) {
+        fprintf(stderr, "Device generation needs the input in one wave, of at most %llu elements\n", (unsigned long long)wave_size);
+        exit(-1);
+    }
+    printf("nr_elements\t%llu\tnr_waves\t%u\n", (unsigned long long)input_size, nr_waves);
+    printf("encoding\t%c%c\tzero_points\t%d,%d\tbits\t%u\tgroup_size\t%u\n", p.signed_x ? 's' : 'u', p.signed_w ? 's' : 'u',
+        p.zero_point_x, p.zero_point_w, p.bits, p.group_size);
+
+    // MRAM layout of every DPU (support/mram_layout.h), pushed once: the operands, the result, the weight scales and,
+    // with output channels, the requantization table, the accumulators and the outputs, for channel_capacity channels.
+    // The host reads back the outputs, or the accumulators with -u 0 and requantizes them to 8 bits itself
+    const unsigned int channel_capacity = divceil(channels_dpu, REQUANT_CHANNELS) * REQUANT_CHANNELS;
+    const unsigned int output_bits = p.requant_bits ? p.requant_bits : 8;
+    mram_layout_t layout;
+    mram_layout_init(&layout);
+    int layout_status = mram_alloc(&layout, TENSOR_X, "X", transfer_size_dpu, p.bits < 8 ? FORMAT_PACKED : FORMAT_INT8, p.bits) |
+        mram_alloc(&layout, TENSOR_W, "W", transfer_size_dpu, p.bits < 8 ? FORMAT_PACKED : FORMAT_INT8, p.bits) |
+        mram_alloc(&layout, TENSOR_RESULT, "result", sizeof(int64_t), FORMAT_INT64, 64) |
+        mram_alloc(&layout, TENSOR_SCALES, "scales", scales_size_dpu, FORMAT_SCALE8, 8);
+    if(p.channels)
+        layout_status |= mram_alloc(&layout, TENSOR_REQUANT, "requant", channel_capacity * sizeof(requant_t), FORMAT_REQUANT, 0) |
+            mram_alloc(&layout, TENSOR_CHANNEL_ACC, "acc", channel_capacity * sizeof(int64_t), FORMAT_INT64, 64) |
+            mram_alloc(&layout, TENSOR_OUTPUT, "outputs", p.requant_bits ? REQUANT_OUTPUT_BYTES(channel_capacity, p.requant_bits) : 0,
+                p.requant_bits < 8 ? FORMAT_PACKED : FORMAT_INT8, p.requant_bits);
+    if(layout_status) {
+        fprintf(stderr, "The tensors of a DPU do not fit in MRAM\n");
+        exit(-1);
+    }
+    mram_layout_print(&layout);
+    DPU_ASSERT(dpu_broadcast_to(dpu_set, "MRAM_LAYOUT", 0, &layout, sizeof(layout), DPU_XFER_DEFAULT));
+    const tensor_desc_t *channel_readback = &layout.tensors[p.requant_bits ? TENSOR_OUTPUT : TENSOR_CHANNEL_ACC];
+    const unsigned int output_bytes_dpu = channel_readback->size;
+    if(p.channels) {
+        printf("channels\t%u\tchannel_size\t%u\trequant_bits\t%u\trelu\t%u\toutput_bytes_dpu\t%u\n", p.channels, channel_size,
+            p.requant_bits, p.relu, output_bytes_dpu);
+    }
 
     // Input/output allocation in host main memory
-    X = malloc(input_size_dpu_8bytes * nr_of_dpus * sizeof(uint8_t));
-    Y = malloc(input_size_dpu_8bytes * nr_of_dpus * sizeof(uint8_t));
-    Y_host = malloc(sizeof(uint32_t));
+    // A streamed input is generated wave by wave into two buffers: one is being filled while the other is transferred
+    if(!p.input_file) {
+        X = malloc(wave_size * (streaming ? 2 : 1) * sizeof(uint8_t));
+        Y = malloc(wave_size * (streaming ? 2 : 1) * sizeof(uint8_t));
+    }
+    // Packed operands and weight scales as pushed to the DPUs, double-buffered like the inputs
+    uint8_t *packed_X = NULL, *packed_Y = NULL, *scales = NULL;
+    if(p.bits < 8) {
+        packed_X = malloc((uint64_t)transfer_size_dpu * nr_of_dpus * (streaming ? 2 : 1));
+        packed_Y = malloc((uint64_t)transfer_size_dpu * nr_of_dpus * (streaming ? 2 : 1));
+    }
+    if(p.group_size)
+        scales = malloc((uint64_t)scales_size_dpu * nr_of_dpus * (streaming ? 2 : 1));
+    Y_host = malloc(sizeof(int64_t));
+    if(p.output_file && tensor_file_create(&output_file, p.output_file, input_size, nr_of_dpus, nr_waves, input_size_dpu_8bytes) != 0)
+        exit(-1);
+    if(p.output_file) {
+        output_file.header.signed_x = p.signed_x;
+        output_file.header.signed_w = p.signed_w;
+        output_file.header.zero_point_x = p.zero_point_x;
+        output_file.header.zero_point_w = p.zero_point_w;
+        output_file.header.bits = p.bits;
+        output_file.header.group_size = p.group_size;
+    }
 
-    uint8_t *bufferX = X;
-    uint8_t *bufferY = Y;
+    // The weights' CSD form is fixed for a weight encoding, so it is recoded and loaded once
+    if(p.kernel == kernel4) {
+        uint16_t csd_digits[CSD_TABLE_SIZE];
+        csd_table(csd_digits, p.signed_w);
+        DPU_ASSERT(dpu_broadcast_to(dpu_set, "CSD_DIGITS", 0, csd_digits, sizeof(csd_digits), DPU_XFER_DEFAULT));
+    }
 
-    unsigned int i = 0;
+    // The requantization parameters are fixed for a layer, so they are loaded once. Channel c of DPU i is global
+    // channel i * channels_dpu + c, the padding of the table is zero
+    requant_t *requant = NULL;
+    int64_t *channel_ref = NULL; // Reference accumulators
+    int8_t *outputs = NULL; // Requantized outputs, from the DPUs or from the host with -u 0
+    if(p.channels) {
+        requant = calloc((uint64_t)channel_capacity * nr_of_dpus, sizeof(requant_t));
+        channel_ref = calloc(p.channels, sizeof(int64_t));
+        outputs = malloc(p.channels);
+        const unsigned int product_bits = 2 * p.bits + (p.group_size ? 8 : 0);
+        for(i = 0; i < nr_of_dpus; i++)
+            for(unsigned int c = 0; c < channels_dpu && i * channels_dpu + c < p.channels; c++)
+                requant_params(&requant[i * channel_capacity + c], i * channels_dpu + c, channel_size, product_bits, output_bits);
+        DPU_FOREACH(dpu_set, dpu, i) {
+            DPU_ASSERT(dpu_prepare_xfer(dpu, requant + i * channel_capacity));
+        }
+        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, DPU_MRAM_HEAP_POINTER_NAME, layout.tensors[TENSOR_REQUANT].offset, layout.tensors[TENSOR_REQUANT].size, DPU_XFER_DEFAULT));
+    }
+    uint8_t *channel_out = p.channels ? malloc((uint64_t)output_bytes_dpu * nr_of_dpus) : NULL; // As read back
+
+    // Transfers and launches are asynchronous when streaming and run in order per rank (support/stream.h), so the
+    // uploads of the next wave overlap the compute of the current one on other ranks, and the host generates and
+    // verifies the next wave meanwhile
+    const dpu_xfer_flags_t xfer_flags = streaming ? DPU_XFER_ASYNC : DPU_XFER_DEFAULT;
+    const dpu_launch_policy_t launch_policy = streaming ? DPU_ASYNCHRONOUS : DPU_SYNCHRONOUS;
+    
+    i = 0;
 
     // Create an input file with arbitrary data
-    read_input(X, Y, input_size);
-    memset(Y_host, 0, sizeof(uint32_t));
-    uint64_t *partial_res = aligned_alloc(8, nr_of_dpus*sizeof(uint64_t));
-    memset(partial_res,0,nr_of_dpus * sizeof(uint64_t));
+    if(!streaming && !p.input_file) {
+        generator_reset(&gen);
+        generate_input(&gen, X, Y, input_size);
+        memset(X + input_size, 0, wave_size - input_size);
+        memset(Y + input_size, 0, wave_size - input_size);
+    }
+    memset(Y_host, 0, sizeof(int64_t));
+    int64_t *partial_res = aligned_alloc(8, nr_of_dpus*sizeof(int64_t));
+    memset(partial_res,0,nr_of_dpus * sizeof(int64_t));
+    // Reference result of every verified DPU. A DPU's own result leaves the zero-points to the correction
+    // DPU 0 adds, so the sampled references take the raw products
+    int64_t *dpu_ref = malloc(nr_of_dpus * sizeof(int64_t));
+    verify_init(&p.verify, nr_of_dpus);
+    struct Params raw_p = p;
+    raw_p.zero_point_x = raw_p.zero_point_w = 0;
+    const struct Params *ref_p = p.verify.mode == VERIFY_SAMPLED ? &raw_p : &p;
+
+    // Arguments and pushed pointers of the waves, double-buffered
+    dpu_arguments_t wave_arguments[2][NR_DPUS];
+    uint8_t *wave_xfer_X[2][NR_DPUS], *wave_xfer_Y[2][NR_DPUS], *wave_xfer_scales[2][NR_DPUS]; // What is pushed: the slices, or their packed copies
+    // Completion of the pushes from the two sets of host buffers when streaming
+    stream_fence_t pushed[2];
+    stream_fence_init(&pushed[0]);
+    stream_fence_init(&pushed[1]);
+    uint32_t nr_ranks;
+    DPU_ASSERT(dpu_get_nr_ranks(dpu_set, &nr_ranks));
 
     // Loop over main kernel
     for(int rep = 0; rep < p.n_warmup + p.n_reps; rep++) {
 
-        // Compute output on CPU (verification purposes)
-        if(rep >= p.n_warmup)
-            start(&timer, 0, rep - p.n_warmup);
-        bitwise_dp(X, Y, Y_host, input_size);
-        if(rep >= p.n_warmup)
-            stop(&timer, 0);
-
-        printf("Load input data\n");
-        // Input arguments
-        unsigned int kernel = 0;
-        dpu_arguments_t input_arguments[NR_DPUS];
-        for(i=0; i<nr_of_dpus-1; i++) {
-            input_arguments[i].size=input_size_dpu_8bytes * sizeof(uint8_t); 
-            input_arguments[i].transfer_size=input_size_dpu_8bytes * sizeof(uint8_t); 
-            input_arguments[i].kernel=kernel;
-        }
-        input_arguments[nr_of_dpus-1].size=(input_size_8bytes - input_size_dpu_8bytes * (NR_DPUS-1)) * sizeof(uint8_t); 
-        input_arguments[nr_of_dpus-1].transfer_size=input_size_dpu_8bytes * sizeof(uint8_t); 
-        input_arguments[nr_of_dpus-1].kernel=kernel;
+        if(streaming && !p.input_file)
+            generator_reset(&gen);
+        memset(dpu_ref, 0, nr_of_dpus * sizeof(int64_t));
+        res = 0;
+
+        for(unsigned int wave = 0; wave < nr_waves; wave++) {
+            const uint64_t wave_offset = wave * wave_size;
+            const uint64_t wave_elements = (input_size - wave_offset) < wave_size ? (input_size - wave_offset) : wave_size;
+            // The host buffers of wave - 2 are refilled once every rank has pushed them
+            if(streaming && wave >= 2) {
+                if(rep >= p.n_warmup)
+                    start(&timer, 5, rep - p.n_warmup + wave);
+                stream_fence_wait(&pushed[wave & 1], nr_ranks);
+                if(rep >= p.n_warmup)
+                    stop(&timer, 5);
+            }
+            // Host buffer of the wave, none with a tensor file, whose slices are mapped
+            uint8_t *bufferX = p.input_file ? NULL : X + (wave & 1) * (streaming ? wave_size : 0);
+            uint8_t *bufferY = p.input_file ? NULL : Y + (wave & 1) * (streaming ? wave_size : 0);
+
+            if(streaming && !p.input_file) {
+                // Generate the next wave while the DPUs are busy with the previous one
+                generate_input(&gen, bufferX, bufferY, wave_elements);
+                memset(bufferX + wave_elements, 0, wave_size - wave_elements);
+                memset(bufferY + wave_elements, 0, wave_size - wave_elements);
+            }
 
-        if(rep >= p.n_warmup)
-            start(&timer, 1, rep - p.n_warmup); // Start timer (CPU-DPU transfers)
-        i = 0;
-		// Copy input arguments
-        // Parallel transfers
-        DPU_FOREACH(dpu_set, dpu, i) {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, &input_arguments[i]));
-        }
-        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(input_arguments[0]), DPU_XFER_DEFAULT));
+            // Signed 1-bit elements are -1/+1, so the zero padding of the last slice adds 1 per element (-1 * -1)
+            const uint64_t binary_padding = p.bits == 1 && p.signed_x && p.signed_w ? (align - wave_elements % align) % align : 0;
+            // Zero-point correction over the whole input, from the bit statistics that are complete on the last wave,
+            // which also takes back the binary padding
+            const int64_t correction = wave < nr_waves - 1 ? 0 :
+                zero_point_correction(p.input_file ? input_file.header.Sx : gen.Sx, p.input_file ? input_file.header.Sw : gen.Sw,
+                                      input_size, p.signed_x, p.signed_w, p.zero_point_x, p.zero_point_w) - (int64_t)binary_padding;
+
+            printf("Load input data\n");
+            // Input arguments
+            unsigned int kernel = p.kernel;
+            // The arguments and pointers of a wave are queued asynchronously, so they alternate between two sets like
+            // the host buffers, and the set of wave - 2 is free after its fence
+            dpu_arguments_t *input_arguments = wave_arguments[wave & 1];
+            uint8_t *dpu_X[NR_DPUS], *dpu_Y[NR_DPUS]; // Per-DPU slices, mapped straight from the tensor file if there is one
+            uint8_t **xfer_X = wave_xfer_X[wave & 1], **xfer_Y = wave_xfer_Y[wave & 1], **xfer_scales = wave_xfer_scales[wave & 1];
+            for(i=0; i<nr_of_dpus; i++) {
+                dpu_X[i] = p.input_file ? tensor_file_slice(&input_file, wave, i, 0) : bufferX + input_size_dpu_8bytes * i;
+                dpu_Y[i] = p.input_file ? tensor_file_slice(&input_file, wave, i, 1) : bufferY + input_size_dpu_8bytes * i;
+
+                uint64_t dpu_offset = (uint64_t)input_size_dpu_8bytes * i;
+                uint64_t wave_elements_8bytes = (wave_elements % align) != 0 ? roundup(wave_elements, align) : wave_elements;
+                unsigned int size = dpu_offset >= wave_elements_8bytes ? 0 :
+                    (wave_elements_8bytes - dpu_offset < input_size_dpu_8bytes ? wave_elements_8bytes - dpu_offset : input_size_dpu_8bytes);
+                input_arguments[i].size=size * sizeof(uint8_t); 
+                input_arguments[i].kernel=kernel;
+                input_arguments[i].wave = wave;
+                input_arguments[i].dpu_rank = i;
+                input_arguments[i].last_wave = wave == nr_waves - 1;
+                input_arguments[i].signed_x = p.signed_x;
+                input_arguments[i].signed_w = p.signed_w;
+                input_arguments[i].zero_point_correction = correction;
+                input_arguments[i].bits = p.bits;
+                input_arguments[i].group_size = p.group_size;
+                input_arguments[i].generate = 0;
+                input_arguments[i].gen = gen.device_gen;
+                input_arguments[i].gen.first = wave_offset + dpu_offset;
+                input_arguments[i].channel_size = channel_size;
+                input_arguments[i].requant_bits = p.requant_bits;
+                input_arguments[i].relu = p.relu;
+                xfer_X[i] = dpu_X[i];
+                xfer_Y[i] = dpu_Y[i];
+                if(p.bits < 8 && !device) {
+                    uint64_t packed_offset = ((wave & 1) * (streaming ? nr_of_dpus : 0) + i) * (uint64_t)transfer_size_dpu;
+                    xfer_X[i] = packed_X + packed_offset;
+                    xfer_Y[i] = packed_Y + packed_offset;
+                    pack_elements(dpu_X[i], xfer_X[i], input_size_dpu_8bytes, p.bits);
+                    pack_elements(dpu_Y[i], xfer_Y[i], input_size_dpu_8bytes, p.bits);
+                }
+                if(p.group_size) {
+                    // slices hold whole groups, so the first group of a slice is its global element offset / group_size
+                    xfer_scales[i] = scales + ((wave & 1) * (streaming ? nr_of_dpus : 0) + i) * (uint64_t)scales_size_dpu;
+                    uint64_t first_group = (wave_offset + dpu_offset) / p.group_size;
+                    for(unsigned int g = 0; g < scales_size_dpu; g++)
+                        xfer_scales[i][g] = group_scale(first_group + g);
+                }
+                if(p.output_file && rep == 0)
+                    tensor_file_write_slice(&output_file, wave, i, dpu_X[i], dpu_Y[i], size);
+            }
 
-        // Copy input arrays
+            // Compute output on CPU (verification purposes), for the sampled DPUs only with -v sampled
+            if(rep >= p.n_warmup)
+                start(&timer, 0, rep - p.n_warmup + wave);
+            for(i=0; i<nr_of_dpus; i++) {
+                if(!verify_dpu(&p.verify, i))
+                    continue;
+                // the zero padding is not part of the input once the zero-points are subtracted
+                uint64_t dpu_offset = (uint64_t)input_size_dpu_8bytes * i;
+                uint64_t valid = dpu_offset >= wave_elements ? 0 :
+                    (wave_elements - dpu_offset < input_size_dpu_8bytes ? wave_elements - dpu_offset : input_size_dpu_8bytes);
+                if(p.channels) {
+                    // one accumulator per channel, the slice holds whole ones
+                    for(uint64_t c = 0; c * channel_size < valid; c++) {
+                        int64_t *acc = channel_ref + i * channels_dpu + c;
+                        *acc = 0;
+                        reference_dp(dpu_X[i] + c * channel_size, dpu_Y[i] + c * channel_size, acc, channel_size, wave_offset + dpu_offset + c * channel_size, ref_p);
+                        dpu_ref[i] += *acc;
+                    }
+                } else {
+                    reference_dp(dpu_X[i], dpu_Y[i], dpu_ref + i, valid, wave_offset + dpu_offset, ref_p);
+                }
+                if(p.verify.mode == VERIFY_SAMPLED && binary_padding)
+                    dpu_ref[i] += input_arguments[i].size - valid;
+            }
+            if(p.verify.mode == VERIFY_SAMPLED && verify_dpu(&p.verify, 0))
+                dpu_ref[0] += correction;
+            if(rep >= p.n_warmup)
+                stop(&timer, 0);
+
+            // The DPUs generate their operands once, untimed, instead of the pushes of every repetition
+            if(device && rep == 0) {
+                dpu_arguments_t generate_arguments[NR_DPUS];
+                DPU_FOREACH(dpu_set, dpu, i) {
+                    generate_arguments[i] = input_arguments[i];
+                    generate_arguments[i].generate = 1;
+                    DPU_ASSERT(dpu_prepare_xfer(dpu, &generate_arguments[i]));
+                }
+                DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(generate_arguments[0]), DPU_XFER_DEFAULT));
+                DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
+            }
+
+            // Streamed pushes overlap the kernels of other ranks, so timer 5 times both together with the fence waits
+            if(rep >= p.n_warmup)
+                start(&timer, streaming ? 5 : 1, rep - p.n_warmup + wave); // Start timer (CPU-DPU transfers)
+            i = 0;
+		    // Copy input arguments
+            // Parallel transfers
+            DPU_FOREACH(dpu_set, dpu, i) {
+                DPU_ASSERT(dpu_prepare_xfer(dpu, &input_arguments[i]));
+            }
+            DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(input_arguments[0]), xfer_flags));
+
+            // Copy input arrays
 #ifdef SERIAL // Serial transfers
 
-        //@@ INSERT SERIAL CPU-DPU TRANSFER HERE
+            //@@ INSERT SERIAL CPU-DPU TRANSFER HERE
 
 #else // Parallel transfers
 
-        //@@ INSERT PARALLEL CPU-DPU TRANSFER HERE
-        // FIRST PUSH X
-        DPU_FOREACH(dpu_set, dpu, i) {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, bufferX + input_size_dpu_8bytes * i));
-        }
-        DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,0,input_size_dpu_8bytes * sizeof(uint8_t), DPU_XFER_DEFAULT));
+            //@@ INSERT PARALLEL CPU-DPU TRANSFER HERE
+            // FIRST PUSH X, unless the DPUs generated it
+            if(!device) {
+                DPU_FOREACH(dpu_set, dpu, i) {
+                    DPU_ASSERT(dpu_prepare_xfer(dpu, xfer_X[i]));
+                }
+                DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,layout.tensors[TENSOR_X].offset,transfer_size_dpu, xfer_flags));
 
-        // then push y
-        DPU_FOREACH(dpu_set, dpu, i) {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, bufferY + input_size_dpu_8bytes * i));
-        }
-        DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,input_size_dpu_8bytes*sizeof(uint8_t), input_size_dpu_8bytes * sizeof(uint8_t), DPU_XFER_DEFAULT));
+                // then push y
+                DPU_FOREACH(dpu_set, dpu, i) {
+                    DPU_ASSERT(dpu_prepare_xfer(dpu, xfer_Y[i]));
+                }
+                DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,layout.tensors[TENSOR_W].offset, transfer_size_dpu, xfer_flags));
+            }
+
+            // and the weight scales
+            if(p.group_size) {
+                DPU_FOREACH(dpu_set, dpu, i) {
+                    DPU_ASSERT(dpu_prepare_xfer(dpu, xfer_scales[i]));
+                }
+                DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,layout.tensors[TENSOR_SCALES].offset, scales_size_dpu, xfer_flags));
+            }
 
 
 
 #endif
-        if(rep >= p.n_warmup)
-            stop(&timer, 1); // Stop timer (CPU-DPU transfers)
+            if(streaming)
+                stream_fence_queue(&pushed[wave & 1], dpu_set);
+            if(rep >= p.n_warmup && !streaming)
+                stop(&timer, 1); // Stop timer (CPU-DPU transfers)
 		
-        printf("Run program on DPU(s) \n");
-        // Run DPU kernel
-        if(rep >= p.n_warmup) {
-            start(&timer, 2, rep - p.n_warmup); // Start timer (DPU kernel)
-        }
-        DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
-        if(rep >= p.n_warmup) {
-            stop(&timer, 2); // Stop timer (DPU kernel)
+            printf("Run program on DPU(s) \n");
+            // Run DPU kernel
+            if(rep >= p.n_warmup && !streaming) {
+                start(&timer, 2, rep - p.n_warmup + wave); // Start timer (DPU kernel)
+            }
+            DPU_ASSERT(dpu_launch(dpu_set, launch_policy));
+            if(streaming && wave == nr_waves - 1)
+                DPU_ASSERT(dpu_sync(dpu_set));
+            if(rep >= p.n_warmup) {
+                stop(&timer, streaming ? 5 : 2); // Stop timer (DPU kernel)
+            }
         }
 
 #if PRINT
@@ -198,15 +500,39 @@ int main(int argc, char **argv) {
         DPU_FOREACH(dpu_set, dpu, i) {
             DPU_ASSERT(dpu_prepare_xfer(dpu, partial_res + i));
         }
-        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, input_size_dpu_8bytes * sizeof(uint8_t) + input_size_dpu_8bytes * sizeof(uint8_t), sizeof(uint64_t), DPU_XFER_DEFAULT));
-        // final collect the res
-        for(int i=0;i<nr_of_dpus;i++) {
-            res += (uint32_t)partial_res[i];
+        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, layout.tensors[TENSOR_RESULT].offset, sizeof(int64_t), DPU_XFER_DEFAULT));
+        // and the channel outputs, or accumulators
+        if(p.channels) {
+            DPU_FOREACH(dpu_set, dpu, i) {
+                DPU_ASSERT(dpu_prepare_xfer(dpu, channel_out + i * (uint64_t)output_bytes_dpu));
+            }
+            DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, channel_readback->offset, output_bytes_dpu, DPU_XFER_DEFAULT));
         }
 
 #endif
-        if(rep >= p.n_warmup)
+        if(rep >= p.n_warmup) {
             stop(&timer, 3); // Stop timer (DPU-CPU transfers)
+            start(&timer, 4, rep - p.n_warmup); // Start timer (host reduction)
+        }
+        // final collect the res
+        for(i = 0; i < nr_of_dpus; i++) {
+            res += partial_res[i];
+        }
+        // the channel outputs, unpacked, or requantized here from the accumulators
+        for(i = 0; i < nr_of_dpus && p.channels; i++) {
+            const uint8_t *out = channel_out + i * (uint64_t)output_bytes_dpu;
+            for(unsigned int c = 0; c < channels_dpu && i * channels_dpu + c < p.channels; c++) {
+                int8_t *y = outputs + i * channels_dpu + c;
+                if(!p.requant_bits)
+                    *y = (int8_t)requantize(((const int64_t *)out)[c], &requant[i * channel_capacity + c], output_bits, p.relu);
+                else if(p.requant_bits == 4)
+                    *y = (int8_t)(out[c / 2] << (4 - 4 * (c & 1))) >> 4;
+                else
+                    *y = (int8_t)out[c];
+            }
+        }
+        if(rep >= p.n_warmup)
+            stop(&timer, 4); // Stop timer (host reduction)
 
 #if defined(CYCLES) || defined(INSTRUCTIONS)
         dpu_results_t results[nr_of_dpus];
@@ -244,6 +570,12 @@ int main(int argc, char **argv) {
         }
 #endif
     }
+    if(p.output_file)
+        tensor_file_close(&output_file);
+    // Bit density of the input, the bit-serial kernels' cycles grow with it
+    printf("bit_density\tX\t%.4f\tW\t%.4f\n",
+        bit_density(p.input_file ? input_file.header.Sx : gen.Sx, input_size),
+        bit_density(p.input_file ? input_file.header.Sw : gen.Sw, input_size));
 #ifdef CYCLES
     printf("DPU cycles  = %g\n", cc / p.n_reps);
 #elif INSTRUCTIONS
@@ -253,25 +585,72 @@ int main(int argc, char **argv) {
     // Print timing results
     printf("CPU ");
     print(&timer, 0, p.n_reps);
-    printf("CPU-DPU ");
-    print(&timer, 1, p.n_reps);
-    printf("DPU Kernel ");
-    print(&timer, 2, p.n_reps);
+    if(streaming) {
+        printf("Streamed ");
+        print(&timer, 5, p.n_reps);
+    } else {
+        printf("CPU-DPU ");
+        print(&timer, 1, p.n_reps);
+        printf("DPU Kernel ");
+        print(&timer, 2, p.n_reps);
+    }
     printf("DPU-CPU ");
     print(&timer, 3, p.n_reps);
+    printf("Host reduction ");
+    print(&timer, 4, p.n_reps);
 
     // Check output
     bool status = true;
 
-    if (res != *Y_host) {
-        status = false;
-        printf("%u(real value) -- %u(dp returned from core) not matching", *Y_host, res);
-    }
+    if (p.verify.mode == VERIFY_FULL) {
+        for(i = 0; i < nr_of_dpus; i++)
+            *Y_host += dpu_ref[i];
+        if (res != *Y_host) {
+            status = false;
+            printf("%lld(real value) -- %lld(dp returned from core) not matching", (long long)*Y_host, (long long)res);
+        }
 
-    else {
-        printf("%u -- %u matched", *Y_host, res);
+        else {
+            printf("%lld -- %lld matched", (long long)*Y_host, (long long)res);
+        }
+    } else if (p.verify.mode == VERIFY_SAMPLED) {
+        // every sampled DPU against its own reference
+        unsigned int checked = 0;
+        for(i = 0; i < nr_of_dpus; i++) {
+            if(!verify_dpu(&p.verify, i))
+                continue;
+            checked++;
+            if (partial_res[i] != dpu_ref[i]) {
+                status = false;
+                printf("DPU %u: %lld(real value) -- %lld(dp returned from core) not matching\n", i, (long long)dpu_ref[i], (long long)partial_res[i]);
+            }
+        }
+        if (status)
+            printf("%u sampled DPU(s) matched", checked);
+    }
+    // and the output of every channel of the verified DPUs
+    if (p.channels && p.verify.mode != VERIFY_OFF) {
+        unsigned int checked = 0, differ = 0;
+        for(i = 0; i < nr_of_dpus; i++) {
+            if(!verify_dpu(&p.verify, i))
+                continue;
+            for(unsigned int c = 0; c < channels_dpu && i * channels_dpu + c < p.channels; c++, checked++) {
+                unsigned int channel = i * channels_dpu + c;
+                int32_t expected = requantize(channel_ref[channel], &requant[i * channel_capacity + c], output_bits, p.relu);
+                if (outputs[channel] != expected && differ++ < 8)
+                    printf("\nchannel %u: %d(real value) -- %d(output from core) not matching", channel, expected, outputs[channel]);
+            }
+        }
+        if (differ) {
+            status = false;
+            printf("\n%u of %u channel outputs differ", differ, checked);
+        } else {
+            printf(", %u channel outputs matched", checked);
+        }
     }
-    if (status) {
+    if (p.verify.mode == VERIFY_OFF) {
+        printf("[" ANSI_COLOR_YELLOW "SKIPPED" ANSI_COLOR_RESET "] Outputs not verified\n");
+    } else if (status) {
         printf("[" ANSI_COLOR_GREEN "OK" ANSI_COLOR_RESET "] Outputs are equal\n");
     } else {
         printf("[" ANSI_COLOR_RED "ERROR" ANSI_COLOR_RESET "] Outputs differ!\n");
@@ -281,6 +660,17 @@ int main(int argc, char **argv) {
     free(X);
     free(Y);
     free(Y_host);
+    free(dpu_ref);
+    free(packed_X);
+    free(packed_Y);
+    free(scales);
+    free(requant);
+    free(channel_ref);
+    free(outputs);
+    free(channel_out);
+    if(p.input_file)
+        tensor_file_close(&input_file);
+    generator_close(&gen);
     DPU_ASSERT(dpu_free(dpu_set)); // Deallocate DPUs
 	
     return status ? 0 : -1;
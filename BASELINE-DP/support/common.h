@@ -32,14 +32,40 @@
 #define DIV 1 // Shift right to divide by sizeof(T)
 #endif
 
+// Parameters of the device generator (-d, support/device_gen.h)
+typedef struct {
+    uint64_t nr_elements; // Elements of the whole input, the rest of the last slice is zero padding
+    uint64_t first; // Global index of the first element of the DPU's slice
+    uint32_t seed;
+    uint32_t type; // enum device_distributions
+    uint32_t param; // relu: zero probability * 2^32, gaussian: DEVICE_SIGMA_SCALE(standard deviation)
+    uint32_t padding;
+} device_gen_t;
+
 // Structures used by both the host and the dpu to communicate information
 typedef struct {
     uint32_t size;
-    uint32_t transfer_size;
 	enum kernels {
-	    kernel1 = 0,
-	    nr_kernels = 1,
+	    kernel1 = 0, // Bit-serial products
+	    kernel2 = 1, // Native 8x8-bit multiply
+	    kernel3 = 2, // Joint-nibble histogram
+	    kernel4 = 3, // Shift-add over canonical signed-digit weights
+	    kernel5 = 4, // AND/XNOR popcount over 1-bit elements
+	    nr_kernels = 5,
 	} kernel;
+	uint32_t dpu_rank;
+	uint32_t wave; // Index of the streamed wave (wave 0 resets the accumulator)
+	uint32_t last_wave; // Set on the final wave
+	uint32_t signed_x; // Two's-complement activations
+	uint32_t signed_w; // Two's-complement weights
+	int64_t zero_point_correction; // Added by DPU 0 on the last wave
+	uint32_t bits; // Element width in MRAM: 8, or 4/2/1 packed (support/packing.h)
+	uint32_t group_size; // Elements per weight scale, 0 without scales
+	uint32_t generate; // Fill X and W from the device generator instead of running the kernel
+	device_gen_t gen;
+	uint32_t channel_size; // Elements per output channel (-n), 0 for a single dot product
+	uint32_t requant_bits; // Epilogue output width, 8 or 4, 0 leaves the accumulators to the host
+	uint32_t relu; // Clip the epilogue outputs at their zero-point
 } dpu_arguments_t; // Input arguments
 
 typedef struct {
@@ -48,8 +74,31 @@ typedef struct {
 
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_YELLOW  "\x1b[33m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
 #define divceil(n, m) (((n)-1) / (m) + 1)
 #define roundup(n, m) ((n / m) * m + m)
+
+// Largest per-DPU wave (bytes per operand) that fits X, Y and the 8-byte accumulator in 64 MB of MRAM
+#define MRAM_SIZE (64 << 20)
+#define MAX_WAVE_SIZE_DPU (((MRAM_SIZE - 8) / 2) & ~7)
+
+// Signed operands are two's complement: the top of planes bit planes weighs -2^(planes-1) (MSB negation).
+// Narrow elements are sign-extended, so any number of planes from their width up gives the same value
+#define MSB_NEGATED(p, is_signed, planes) ((is_signed) && (p) == (int)(planes) - 1)
+
+// Sum of the values of an operand, from its bit statistics
+static inline int64_t bit_stats_sum(const uint64_t S[8], uint32_t is_signed) {
+    int64_t sum = 0;
+    for(int b = 0; b < 8; b++)
+        sum += (MSB_NEGATED(b, is_signed, 8) ? -(int64_t)S[b] : (int64_t)S[b]) * (1 << b);
+    return sum;
+}
+
+// Zero-point correction terms: sum (x - zx) * (w - zw) = sum x * w - zw * sum x - zx * sum w + N * zx * zw
+static inline int64_t zero_point_correction(const uint64_t Sx[8], const uint64_t Sw[8], uint64_t N,
+                                            uint32_t signed_x, uint32_t signed_w, int32_t zx, int32_t zw) {
+    return -(int64_t)zw * bit_stats_sum(Sx, signed_x) - (int64_t)zx * bit_stats_sum(Sw, signed_w) + (int64_t)N * zx * zw;
+}
 #endif
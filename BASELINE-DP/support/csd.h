@@ -0,0 +1,46 @@
+#ifndef _CSD_H_
+#define _CSD_H_
+
+#include <stdint.h>
+
+/*
+ * Canonical signed-digit (CSD) weights for the shift-add kernel (-k 3)
+ *
+ * Every weight is w = sum_q d_q * 2^q with digits d_q in {-1, 0, 1} and no two adjacent non-zero digits,
+ * which has a third fewer non-zero digits than the binary form on average. The recoding is done once on
+ * the host, per weight value, into a table that the DPU indexes with the weight byte:
+ *   low byte: the +1 digits at planes 0..7, high byte: the -1 digits at planes 0..7.
+ * Signed weights fit these 8 planes; unsigned weights above CSD_MAX_8_DIGITS also have a +1 digit at plane 8.
+ */
+
+#define CSD_TABLE_SIZE 256
+#define CSD_MAX_8_DIGITS 170 // 0b10101010, the largest value of 8 digits
+
+// Digits of value (-128..255) as positive and negative masks over planes 0..8
+static inline void csd_recode(int value, uint32_t *pos, uint32_t *neg) {
+    *pos = 0;
+    *neg = 0;
+    for(int q = 0; value != 0; q++, value >>= 1) { // arithmetic shift, value stays exact after each digit
+        if(value & 1) {
+            // ...01 -> +1, ...11 -> -1, which leaves ...00 and no adjacent non-zero digit
+            if((value & 3) == 3) {
+                *neg |= 1U << q;
+                value += 1;
+            } else {
+                *pos |= 1U << q;
+                value -= 1;
+            }
+        }
+    }
+}
+
+// Table of the weight bytes in CSD form, for unsigned or two's-complement weights
+void csd_table(uint16_t table[CSD_TABLE_SIZE], uint32_t is_signed) {
+    for(int b = 0; b < CSD_TABLE_SIZE; b++) {
+        uint32_t pos, neg;
+        csd_recode(is_signed ? (int8_t)b : b, &pos, &neg);
+        table[b] = (uint16_t)((pos & 0xff) | (neg << 8));
+    }
+}
+
+#endif
@@ -0,0 +1,239 @@
+#ifndef _GENERATORS_H_
+#define _GENERATORS_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "device_gen.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+/*
+ * Input generators
+ *
+ * The bit-serial kernels skip zero bits, so their speed depends on the value distribution:
+ *   binary   : 0/1 values (the original benchmark input, every high bit is zero)
+ *   uniform  : uniform 8-bit values
+ *   relu     : post-ReLU activations, a fraction param (default 0.5) of them zero, with Gaussian weights
+ *   gaussian : Gaussian-quantized activations and weights, param is the standard deviation (default 32)
+ *   dump     : raw 8-bit activation and weight dumps (-x/-y), repeated if shorter than the input
+ * Gaussian values are quantized with a zero-point of 128 for unsigned operands, and centered and clamped to
+ * [-128, 127] for signed ones (-q s), whose ReLU activations are clamped to 127.
+ * Narrower elements (generator_set_format) keep the top bits of each value (binary values already fit),
+ * sign-extended for signed operands; signed 1-bit elements are -1 or +1, +1 for a set bit. generator_set_device switches to the integer generator the DPUs run
+ * with -d (support/device_gen.h), which follows the same distributions with other samples.
+ */
+
+enum generator_type {
+    GEN_BINARY = 0,
+    GEN_UNIFORM,
+    GEN_RELU,
+    GEN_GAUSSIAN,
+    GEN_DUMP,
+    nr_generators,
+};
+
+static const char *generator_names[nr_generators] = {"binary", "uniform", "relu", "gaussian", "dump"};
+
+typedef struct {
+    enum generator_type type;
+    double param;
+    FILE *dump_x;
+    FILE *dump_w;
+    uint64_t Sx[8]; // Bit statistics of the elements generated since the last reset
+    uint64_t Sw[8];
+    uint64_t nr_elements;
+    unsigned int bits; // Element width, 0 or 8 for full bytes
+    uint32_t signed_x;
+    uint32_t signed_w;
+    uint32_t device; // Elements of the device generator instead
+    device_gen_t device_gen;
+} generator_t;
+
+// Returns 0 on success. A negative param selects the default of the generator
+int generator_init(generator_t *g, const char *name, double param, const char *dump_x, const char *dump_w) {
+    memset(g, 0, sizeof(*g));
+    for(g->type = 0; g->type < nr_generators; g->type++)
+        if(!strcmp(name, generator_names[g->type]))
+            break;
+    if(g->type == nr_generators) {
+        fprintf(stderr, "Unknown generator %s\n", name);
+        return -1;
+    }
+    g->param = param >= 0 ? param : (g->type == GEN_RELU ? 0.5 : 32.0);
+    if(g->type == GEN_DUMP) {
+        g->dump_x = dump_x ? fopen(dump_x, "rb") : NULL;
+        g->dump_w = dump_w ? fopen(dump_w, "rb") : NULL;
+        if(!g->dump_x || !g->dump_w) {
+            fprintf(stderr, "The dump generator needs readable -x and -y files\n");
+            return -1;
+        }
+    }
+    return 0;
+}
+
+void generator_set_format(generator_t *g, unsigned int bits, uint32_t signed_x, uint32_t signed_w) {
+    g->bits = bits;
+    g->signed_x = signed_x;
+    g->signed_w = signed_w;
+}
+
+// Generate the elements of the device generator with seed, over an input of nr_elements. Returns 0 on success
+int generator_set_device(generator_t *g, uint32_t seed, uint64_t nr_elements) {
+    if(g->type == GEN_DUMP) {
+        fprintf(stderr, "The dump generator cannot run on the DPUs\n");
+        return -1;
+    }
+    g->device = 1;
+    g->device_gen.seed = seed;
+    g->device_gen.nr_elements = nr_elements;
+    g->device_gen.type = g->type;
+    g->device_gen.param = g->type == GEN_RELU ? (g->param >= 1.0 ? UINT32_MAX : (uint32_t)(g->param * 4294967296.0)) :
+        DEVICE_SIGMA_SCALE(g->param);
+    return 0;
+}
+
+void generator_close(generator_t *g) {
+    if(g->dump_x)
+        fclose(g->dump_x);
+    if(g->dump_w)
+        fclose(g->dump_w);
+    memset(g, 0, sizeof(*g));
+}
+
+// Restart the sequence, so that every repetition (and every streamed pass) sees the same input
+void generator_reset(generator_t *g) {
+    srand(0);
+    if(g->type == GEN_DUMP) {
+        rewind(g->dump_x);
+        rewind(g->dump_w);
+    }
+    memset(g->Sx, 0, sizeof(g->Sx));
+    memset(g->Sw, 0, sizeof(g->Sw));
+    g->nr_elements = 0;
+}
+
+static double gaussian_sample(double sigma) {
+    // Box-Muller
+    double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+    return sigma * sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+// Rounds and saturates v to the range of the operand, [0, 255] or [-128, 127] if is_signed
+static uint8_t quantize(double v, uint32_t is_signed) {
+    v = round(v);
+    if(is_signed)
+        return (uint8_t)(int8_t)(v < -128 ? -128 : (v > 127 ? 127 : v));
+    return v < 0 ? 0 : (v > 255 ? 255 : (uint8_t)v);
+}
+
+static void read_dump(FILE *f, uint8_t *buffer, uint64_t nr_elements) {
+    uint64_t done = 0;
+    while(done < nr_elements) {
+        size_t n = fread(buffer + done, 1, nr_elements - done, f);
+        if(n == 0) {
+            if(ftell(f) == 0) { // empty dump
+                memset(buffer + done, 0, nr_elements - done);
+                return;
+            }
+            rewind(f);
+        }
+        done += n;
+    }
+}
+
+// Requantize 8-bit values to their top bits
+static void narrow(uint8_t *buffer, uint64_t nr_elements, unsigned int bits, uint32_t is_signed) {
+    for(uint64_t i = 0; i < nr_elements; i++)
+        buffer[i] = is_signed ? (uint8_t)((int8_t)buffer[i] >> (8 - bits)) : buffer[i] >> (8 - bits);
+}
+
+// Signed 1-bit elements are -1/+1 (binary networks) rather than the two's complement 0/-1
+static void binarize(uint8_t *buffer, uint64_t nr_elements) {
+    for(uint64_t i = 0; i < nr_elements; i++)
+        buffer[i] = buffer[i] & 1 ? 1 : 0xff;
+}
+
+// Elements of the device generator, from the current position on
+static void generate_device_input(generator_t *g, uint8_t *A, uint8_t *B, uint64_t nr_elements) {
+    // in chunks, the device generator takes 32-bit counts
+    for(uint64_t i = 0; i < nr_elements; i += 1 << 30) {
+        uint32_t n = nr_elements - i < (1 << 30) ? (uint32_t)(nr_elements - i) : 1 << 30;
+        device_generate(&g->device_gen, 0, g->bits, g->signed_x, g->nr_elements + i, n, A + i);
+        device_generate(&g->device_gen, 1, g->bits, g->signed_w, g->nr_elements + i, n, B + i);
+    }
+}
+
+static void generate_host_input(generator_t *g, uint8_t *A, uint8_t *B, uint64_t nr_elements) {
+    switch(g->type) {
+    case GEN_BINARY:
+        for(uint64_t i = 0; i < nr_elements; i++) {
+            A[i] = (uint8_t) (rand() % 2);
+            B[i] = (uint8_t) (rand() % 2);
+        }
+        break;
+    case GEN_UNIFORM:
+        for(uint64_t i = 0; i < nr_elements; i++) {
+            A[i] = (uint8_t) (rand() % 256);
+            B[i] = (uint8_t) (rand() % 256);
+        }
+        break;
+    case GEN_RELU:
+        for(uint64_t i = 0; i < nr_elements; i++) {
+            A[i] = (rand() < g->param * RAND_MAX) ? 0 : quantize(fabs(gaussian_sample(32.0)), g->signed_x);
+            B[i] = quantize((g->signed_w ? 0 : 128) + gaussian_sample(32.0), g->signed_w);
+        }
+        break;
+    case GEN_GAUSSIAN:
+        for(uint64_t i = 0; i < nr_elements; i++) {
+            A[i] = quantize((g->signed_x ? 0 : 128) + gaussian_sample(g->param), g->signed_x);
+            B[i] = quantize((g->signed_w ? 0 : 128) + gaussian_sample(g->param), g->signed_w);
+        }
+        break;
+    case GEN_DUMP:
+        read_dump(g->dump_x, A, nr_elements);
+        read_dump(g->dump_w, B, nr_elements);
+        break;
+    default:
+        break;
+    }
+    if(g->bits && g->bits < 8 && g->type != GEN_BINARY) {
+        narrow(A, nr_elements, g->bits, g->signed_x);
+        narrow(B, nr_elements, g->bits, g->signed_w);
+    }
+    if(g->bits == 1 && g->signed_x)
+        binarize(A, nr_elements);
+    if(g->bits == 1 && g->signed_w)
+        binarize(B, nr_elements);
+}
+
+// Create input arrays
+void generate_input(generator_t *g, uint8_t *A, uint8_t *B, uint64_t nr_elements) {
+    if(g->device)
+        generate_device_input(g, A, B, nr_elements);
+    else
+        generate_host_input(g, A, B, nr_elements);
+    for(uint64_t i = 0; i < nr_elements; i++) {
+        for(int b = 0; b < 8; b++) {
+            g->Sx[b] += (A[i] >> b) & 1;
+            g->Sw[b] += (B[i] >> b) & 1;
+        }
+    }
+    g->nr_elements += nr_elements;
+}
+
+// Fraction of set bits over nr_elements 8-bit values
+double bit_density(const uint64_t S[8], uint64_t nr_elements) {
+    uint64_t ones = 0;
+    for(int b = 0; b < 8; b++)
+        ones += S[b];
+    return nr_elements ? (double)ones / (8.0 * nr_elements) : 0.0;
+}
+
+#endif
@@ -0,0 +1,87 @@
+#ifndef _MRAM_LAYOUT_H_
+#define _MRAM_LAYOUT_H_
+
+#include <stdint.h>
+#include <stdio.h>
+
+/*
+ * MRAM layout manager and tensor table
+ *
+ * The host lays out the MRAM heap of the DPUs with a bump allocator, one slot per tensor of enum tensor_ids, each
+ * 8-byte aligned and sized for the largest slice, so that all DPUs share a layout. It broadcasts the table once,
+ * to MRAM_LAYOUT in WRAM, and pushes and reads every tensor at its offset; the kernels take the addresses of
+ * their operands from the table instead of recomputing the layout. Tensors of size 0 are absent. The default
+ * layout is [X][W][8-byte result][weight scales], BASELINE-DP's output channels (-n) add their tables behind.
+ */
+
+enum tensor_ids {
+    TENSOR_X = 0, // Activations
+    TENSOR_W, // Weights
+    TENSOR_RESULT, // 8-byte result, accumulated across waves
+    TENSOR_SCALES, // 8-bit weight scales, one per group (-c)
+    TENSOR_REQUANT, // requant_t per output channel (-n, support/requant.h)
+    TENSOR_CHANNEL_ACC, // int64 accumulator per output channel
+    TENSOR_OUTPUT, // Requantized outputs (-u)
+    NR_TENSORS,
+};
+
+enum tensor_formats {
+    FORMAT_INT8 = 0, // One element per byte
+    FORMAT_PACKED, // Elements of bits bits packed little-endian (support/packing.h)
+    FORMAT_BITMAP, // Compressed segments (support/sparse.h)
+    FORMAT_RLE,
+    FORMAT_INT64,
+    FORMAT_SCALE8, // 8-bit fixed-point scales
+    FORMAT_REQUANT, // requant_t
+};
+
+typedef struct {
+    char name[8]; // NUL-padded
+    uint32_t offset; // Bytes from DPU_MRAM_HEAP_POINTER
+    uint32_t size; // Bytes, 0 if the tensor is absent
+    uint32_t format; // enum tensor_formats
+    uint32_t bits; // Element width
+} tensor_desc_t;
+
+typedef struct {
+    tensor_desc_t tensors[NR_TENSORS];
+    uint32_t top; // End of the allocated heap
+    uint32_t padding;
+} mram_layout_t;
+
+static inline void mram_layout_init(mram_layout_t *l) {
+    *l = (mram_layout_t){0};
+}
+
+// Allocates size bytes for tensor id behind the previous ones. Returns -1 if the heap outgrows MRAM_SIZE
+static inline int mram_alloc(mram_layout_t *l, uint32_t id, const char *name, uint64_t size, uint32_t format, uint32_t bits) {
+    tensor_desc_t *t = &l->tensors[id];
+    for(unsigned int c = 0; c < sizeof(t->name); c++)
+        t->name[c] = *name ? *name++ : '\0';
+    t->offset = l->top;
+    t->size = (uint32_t)((size + 7) & ~7ULL);
+    t->format = format;
+    t->bits = bits;
+    if((uint64_t)l->top + t->size > MRAM_SIZE)
+        return -1;
+    l->top += t->size;
+    return 0;
+}
+
+// Prints the allocated tensors as name, offset and size triples
+static inline void mram_layout_print(const mram_layout_t *l) {
+    printf("mram_layout");
+    for(unsigned int id = 0; id < NR_TENSORS; id++)
+        if(l->tensors[id].size)
+            printf("\t%.8s\t%u\t%u", l->tensors[id].name, l->tensors[id].offset, l->tensors[id].size);
+    printf("\n");
+}
+
+#ifdef DPU_MRAM_HEAP_POINTER
+// DPU side: MRAM address of a tensor of the table
+static inline uint32_t mram_tensor(const mram_layout_t *l, uint32_t id) {
+    return (uint32_t)DPU_MRAM_HEAP_POINTER + l->tensors[id].offset;
+}
+#endif
+
+#endif
@@ -0,0 +1,90 @@
+#ifndef _PACKING_H_
+#define _PACKING_H_
+
+#include <stdint.h>
+
+/*
+ * Packed sub-byte operands (-b) and group-wise weight scales (-c)
+ *
+ * Elements of 4 or 2 bits are packed little-endian into bytes (element i in bits (i % (8 / bits)) * bits
+ * of byte i * bits / 8) for the CPU-DPU transfers and in MRAM, and unpacked into the 8-bit WRAM caches,
+ * sign-extended for signed operands. The host keeps one byte per element, so the references, the bit
+ * statistics and tensor files are the same as for 8-bit operands whose values fit in bits.
+ * 1-bit elements (BASELINE-DP's binary kernel) are 0/1, or -1/+1 when signed as in binary networks, packed
+ * as a set bit for 1 or +1; they stay packed in WRAM.
+ * MRAM per DPU: [X, packed][W, packed][8-byte result][one 8-bit weight scale per group of group_size elements]
+ * The result is sum over groups g of scale[g] * sum x * w; the scales are fixed point with an implicit
+ * exponent, which is left to the caller.
+ */
+
+// Bytes of nr_elements packed elements of bits bits
+#define PACKED_BYTES(nr_elements, bits) (((nr_elements) * (bits)) >> 3)
+
+// Elements per DPU must keep packed slices 8-byte aligned and hold whole scale groups
+static inline unsigned int packed_alignment(unsigned int bits, unsigned int group_size) {
+    unsigned int align = 64 / bits;
+    return group_size > align ? group_size : align;
+}
+
+// Largest per-DPU wave (elements per operand) that fits the packed X, W, the result and the scales in MRAM
+static inline unsigned int max_wave_size_dpu(unsigned int bits, unsigned int group_size) {
+    uint64_t bytes = (uint64_t)MRAM_SIZE - 16; // result and the padding of the scales
+    uint64_t elements = group_size ? bytes * 8 * group_size / (2 * bits * group_size + 8) : bytes * 8 / (2 * bits);
+    unsigned int align = packed_alignment(bits, group_size);
+    return (unsigned int)(elements / align * align);
+}
+
+// Synthetic 8-bit weight scale of a global group of elements, a hash of its index
+static inline uint8_t group_scale(uint64_t group) {
+    group ^= group >> 33;
+    group *= 0xff51afd7ed558ccdULL;
+    group ^= group >> 33;
+    return (uint8_t)(1 + group % 255);
+}
+
+// Sum of the scales of elements [first, last), which weighs the approximated products of PAC
+static inline uint64_t group_scale_sum(uint64_t first, uint64_t last, unsigned int group_size) {
+    uint64_t sum = 0;
+    while(first < last) {
+        uint64_t group_end = (first / group_size + 1) * group_size;
+        uint64_t end = group_end < last ? group_end : last;
+        sum += (end - first) * group_scale(first / group_size);
+        first = end;
+    }
+    return sum;
+}
+
+// Pack nr_elements (a multiple of 8 / bits) into dst
+void pack_elements(const uint8_t *src, uint8_t *dst, uint64_t nr_elements, unsigned int bits) {
+    unsigned int per_byte = 8 / bits;
+    uint8_t mask = (uint8_t)((1 << bits) - 1);
+    for(uint64_t i = 0; i < nr_elements; i += per_byte) {
+        uint8_t byte = 0;
+        for(unsigned int e = 0; e < per_byte; e++) {
+            uint8_t v = src[i + e];
+            // 0 and -1 (0xff) clear the bit of a 1-bit element, 1 sets it
+            byte |= (bits == 1 ? (v ^ v >> 7) & 1 : v & mask) << (e * bits);
+        }
+        dst[i / per_byte] = byte;
+    }
+}
+
+// Unpack nr_elements in place: the packed elements are the last PACKED_BYTES(nr_elements, bits) bytes of
+// cache, and each packed byte is read before the elements unpacked from it overwrite it
+void unpack_block(uint8_t *cache, unsigned int nr_elements, unsigned int bits, uint32_t is_signed) {
+    if(bits == 8)
+        return;
+    const uint8_t *packed = cache + nr_elements - PACKED_BYTES(nr_elements, bits);
+    unsigned int per_byte = 8 / bits;
+    unsigned int shift = 8 - bits;
+    uint8_t mask = (uint8_t)((1 << bits) - 1);
+    for(unsigned int i = 0; i < nr_elements; i += per_byte) {
+        uint8_t byte = packed[i / per_byte];
+        for(unsigned int e = 0; e < per_byte; e++) {
+            uint8_t v = (byte >> (e * bits)) & mask;
+            cache[i + e] = is_signed ? (uint8_t)((int8_t)(v << shift) >> shift) : v;
+        }
+    }
+}
+
+#endif
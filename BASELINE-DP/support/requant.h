@@ -0,0 +1,61 @@
+#ifndef _REQUANT_H_
+#define _REQUANT_H_
+
+#include <stdint.h>
+
+/*
+ * Output channels (-n) and the fused requantization epilogue (-u)
+ *
+ * With -n C the input holds C output channels of equal length, one after the other, and every DPU whole
+ * channels, so that each DPU has complete channel accumulators. After the dot products the DPU maps each to
+ *   y = clamp(round((acc + bias) * multiplier / 2^shift) + zero_point, lo, hi)
+ * with [lo, hi] the range of the signed output width (8 or 4 bits) and lo raised to the zero-point for ReLU
+ * (-l), and writes y back to MRAM, int4 packed two per byte like support/packing.h. The multiplier is 15-bit
+ * fixed point, so that (acc + bias) * multiplier fits in 64 bits for any accumulator of a full MRAM wave.
+ * MRAM per DPU (support/mram_layout.h), each for the DPU's channels rounded up to REQUANT_CHANNELS: a requant_t
+ * (TENSOR_REQUANT), an int64 accumulator (TENSOR_CHANNEL_ACC) and an output (TENSOR_OUTPUT) per channel
+ * With -u 0 the host reads the accumulators instead and requantizes them itself.
+ */
+
+typedef struct {
+    int64_t bias; // In accumulator units
+    int32_t multiplier; // Q15, in [0.5, 1)
+    int16_t shift; // Right shift of the product, rounded
+    int16_t zero_point; // Of the output
+} requant_t;
+
+#define REQUANT_CHANNELS 16 // Channels per epilogue step: 8 output bytes at 4 bits, 256 bytes of requant_t
+// The epilogue stages the requant_t of a step in a block cache, so output channels need BLOCK >= 8
+#define REQUANT_MIN_BLOCK_SIZE (REQUANT_CHANNELS * sizeof(requant_t))
+
+// Output bytes of nr_channels channels, in whole epilogue steps
+#define REQUANT_OUTPUT_BYTES(nr_channels, bits) (((nr_channels) + REQUANT_CHANNELS - 1) / REQUANT_CHANNELS * REQUANT_CHANNELS * (bits) / 8)
+
+static inline int32_t requantize(int64_t acc, const requant_t *r, uint32_t bits, uint32_t relu) {
+    int64_t v = (acc + r->bias) * r->multiplier;
+    int64_t y = (r->shift ? (v + ((int64_t)1 << (r->shift - 1))) >> r->shift : v) + r->zero_point;
+    int32_t hi = (1 << (bits - 1)) - 1;
+    int32_t lo = relu ? r->zero_point : -hi - 1;
+    return y < lo ? lo : (y > hi ? hi : (int32_t)y);
+}
+
+// Synthetic requantization of a global channel of channel_size elements, a hash of its index like the weight
+// scales. The shift maps the largest accumulator, channel_size products of product_bits bits, to about the
+// output range, the bias shifts the outputs by up to a quarter of it
+void requant_params(requant_t *r, uint64_t channel, uint32_t channel_size, uint32_t product_bits, uint32_t bits) {
+    uint64_t h = channel + 1;
+    h ^= h >> 33;
+    h *= 0xff51afd7ed558ccdULL;
+    h ^= h >> 33;
+    int log2_size = 0;
+    while((1ULL << log2_size) < channel_size)
+        log2_size++;
+    int32_t zero_point_range = bits == 8 ? 4 : 1;
+    r->multiplier = (1 << 14) + (int32_t)(h & 0x3fff);
+    r->shift = (int16_t)(15 + log2_size + product_bits - (bits - 1));
+    int64_t bias_range = (int64_t)1 << (log2_size + product_bits - 2);
+    r->bias = (int64_t)((h >> 14) % (uint64_t)(2 * bias_range + 1)) - bias_range;
+    r->zero_point = (int16_t)((int32_t)((h >> 54) % (2 * zero_point_range + 1)) - zero_point_range);
+}
+
+#endif
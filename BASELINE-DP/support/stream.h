@@ -0,0 +1,58 @@
+#ifndef _STREAM_H_
+#define _STREAM_H_
+
+#include <pthread.h>
+#include <stdint.h>
+#include <dpu.h>
+
+/*
+ * Streamed waves (support/params.h -s, or inputs larger than the MRAM)
+ *
+ * The pushes and the launch of every wave are queued asynchronously and run in order per rank, without a sync
+ * of the whole set in between, so a rank that is done with wave w uploads wave w + 1 while slower ranks still
+ * compute wave w. The host buffers (inputs, packed copies, arguments) alternate between two sets, so those of
+ * wave w are refilled by wave w + 2: a callback queued behind the pushes of a wave counts the ranks that have
+ * read them, and the host waits for all ranks before it refills the set.
+ */
+
+typedef struct {
+    pthread_mutex_t mutex;
+    pthread_cond_t done;
+    uint32_t nr_ranks; // Ranks whose pushes are done
+} stream_fence_t;
+
+static inline void stream_fence_init(stream_fence_t *f) {
+    pthread_mutex_init(&f->mutex, NULL);
+    pthread_cond_init(&f->done, NULL);
+    f->nr_ranks = 0;
+}
+
+// Called by every rank once it reaches the callback in its queue
+static dpu_error_t stream_fence_signal(struct dpu_set_t rank, uint32_t rank_id, void *arg) {
+    (void)rank;
+    (void)rank_id;
+    stream_fence_t *f = (stream_fence_t *)arg;
+    pthread_mutex_lock(&f->mutex);
+    f->nr_ranks++;
+    pthread_cond_broadcast(&f->done);
+    pthread_mutex_unlock(&f->mutex);
+    return DPU_OK;
+}
+
+// Queues the fence behind the pushes queued so far on every rank of set
+static inline void stream_fence_queue(stream_fence_t *f, struct dpu_set_t set) {
+    pthread_mutex_lock(&f->mutex);
+    f->nr_ranks = 0;
+    pthread_mutex_unlock(&f->mutex);
+    DPU_ASSERT(dpu_callback(set, stream_fence_signal, f, DPU_CALLBACK_ASYNC));
+}
+
+// Waits until the nr_ranks ranks have passed the fence
+static inline void stream_fence_wait(stream_fence_t *f, uint32_t nr_ranks) {
+    pthread_mutex_lock(&f->mutex);
+    while(f->nr_ranks < nr_ranks)
+        pthread_cond_wait(&f->done, &f->mutex);
+    pthread_mutex_unlock(&f->mutex);
+}
+
+#endif
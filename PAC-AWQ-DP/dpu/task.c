@@ -12,38 +12,104 @@
 
 #include "../support/common.h"
 #include "../support/cyclecount.h"
+#include "../support/sched.h"
+#include "../support/packing.h"
+#include "../support/device_gen.h"
+#include "../support/mram_layout.h"
 
 
 #define P_BITS 8
 #define Q_BITS 8
 
+// Full unrolling of the bit-plane loops of the specialized kernels
+#ifdef __clang__
+#define UNROLL _Pragma("unroll")
+#else
+#define UNROLL
+#endif
+
 // Input and output arguments
 __host dpu_arguments_t DPU_INPUT_ARGUMENTS;
 __host dpu_results_t DPU_RESULTS[NR_TASKLETS];
+__host mram_layout_t MRAM_LAYOUT; // Tensor table, pushed once by the host
 
 // Barrier
 BARRIER_INIT(my_barrier, NR_TASKLETS);
 
 extern int main_kernel1(void);
-int (*kernels[nr_kernels])(void) = {main_kernel1};
+extern int main_kernel2(void);
+extern int main_kernel3(void);
+extern int main_kernel4(void);
+extern int main_kernel5(void);
+int (*kernels[nr_kernels])(void) = {main_kernel1, main_kernel2, main_kernel3, main_kernel4, main_kernel5};
+extern int generate_operands(void);
 int main(void) { 
+    // Device generation (-d), once before the first kernel
+    if(DPU_INPUT_ARGUMENTS.generate)
+        return generate_operands();
     // Kernel
     return kernels[DPU_INPUT_ARGUMENTS.kernel](); 
 }
 
 
 
-static uint32_t res_array[NR_TASKLETS];
+static int64_t res_array[NR_TASKLETS];
 
+// Weight scale of a group, read with the 7 that follow it since MRAM reads are 8-byte aligned
+static uint8_t read_group_scale(uint32_t mram_base_addr_scales, uint32_t group, uint8_t scales[8], uint32_t *cached) {
+    if((group & ~7) != *cached) {
+        *cached = group & ~7;
+        mram_read((__mram_ptr void const*)(mram_base_addr_scales + *cached), scales, 8);
+    }
+    return scales[group & 7];
+}
 
-// main_kernel1
-int main_kernel1() {
+// Bit planes in use by a cached block: the position of the highest bit set in any of its elements.
+// n is a multiple of 8 and the cache 8-byte aligned, so the OR-reduction runs over 32-bit words
+static uint32_t block_planes(const uint8_t *cache, uint32_t n) {
+    const uint32_t *words = (const uint32_t *)cache;
+    uint32_t v = 0;
+    for(uint32_t i = 0; i < n / 4; i++)
+        v |= words[i];
+    v |= v >> 16;
+    v |= v >> 8;
+    v &= 0xff;
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+// Exact products of the bit planes from thres up of elements [from, to) of one tier, added to block_res
+// (block_res[1] collects the products of one negated bit plane). Planes from planes_x/planes_y up are empty
+static inline __attribute__((always_inline)) void tier_dp(const uint8_t *cache_X, const uint8_t *cache_Y, uint32_t from, uint32_t to,
+                                                          const int p_bits, const int q_bits, const int thres, int neg_p, int neg_q,
+                                                          int planes_x, int planes_y, uint32_t block_res[2]) {
+    for(uint32_t i = from; i < to; i++) {
+        uint8_t a = cache_X[i], b = cache_Y[i];
+        UNROLL
+        for(int p = thres; p < p_bits; p++) {
+            if(p >= planes_x) break;
+            if(!((a>>p)&1)) continue;
+            UNROLL
+            for(int q = thres; q < q_bits; q++) {
+                if(q >= planes_y) break;
+                if((b>>q)&1) {
+                    block_res[(p == neg_p) ^ (q == neg_q)] += 1U << (p+q);
+                }
+            }
+        }
+    }
+}
+
+// PAC over p_bits x q_bits bit planes with the thresholds of the precision tiers. The specialized kernels pass
+// their threshold as a constant (fixed_thres, -1 for the generic kernel), so that the bit-plane loops are
+// unrolled and the plane weights and signs are folded at compile time
+static inline __attribute__((always_inline)) int pac_kernel(const int p_bits, const int q_bits, const int fixed_thres) {
     unsigned int tasklet_id = me();
 #if PRINT
     printf("tasklet_id = %u\n", tasklet_id);
 #endif
     if (tasklet_id == 0){ 
         mem_reset(); // Reset the heap
+        sched_init(); // Reset the block distribution
 #ifdef CYCLES
         perfcounter_config(COUNT_CYCLES, true); // Initialize once the cycle counter
 #elif INSTRUCTIONS
@@ -55,66 +121,75 @@ int main_kernel1() {
 #if defined(CYCLES) || defined(INSTRUCTIONS)
     perfcounter_count count;
     dpu_results_t *result = &DPU_RESULTS[tasklet_id];
-    result->count = 0;
+    if(DPU_INPUT_ARGUMENTS.wave == 0) result->count = 0; // Streamed waves accumulate their counts
     counter_start(&count); // START TIMER
 #endif
 
-    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size; // Input size per DPU in bytes
-    uint32_t input_size_dpu_bytes_transfer = DPU_INPUT_ARGUMENTS.transfer_size; // Transfer input size per DPU in bytes
-    uint32_t Thres = DPU_INPUT_ARGUMENTS.threshold;
-    uint32_t N = DPU_INPUT_ARGUMENTS.total_elements;
-    uint32_t *Sx = DPU_INPUT_ARGUMENTS.Sx;
-    uint32_t *Sw = DPU_INPUT_ARGUMENTS.Sw;
-    uint32_t N_exact = DPU_INPUT_ARGUMENTS.exact_count;
-    uint32_t num_exact_dpus = DPU_INPUT_ARGUMENTS.num_exact_dpus;
-    uint32_t rank = DPU_INPUT_ARGUMENTS.dpu_rank;
+    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size; // Input size per DPU in bytes (elements when packed)
+    uint32_t nr_tiers = DPU_INPUT_ARGUMENTS.nr_tiers;
+    const tier_t *tiers = DPU_INPUT_ARGUMENTS.tiers;
+    uint32_t wave = DPU_INPUT_ARGUMENTS.wave;
+    // bit planes weighing -2^(bits-1) (p_bits/q_bits never match for unsigned operands)
+    int neg_p = DPU_INPUT_ARGUMENTS.signed_x ? p_bits - 1 : p_bits;
+    int neg_q = DPU_INPUT_ARGUMENTS.signed_w ? q_bits - 1 : q_bits;
 
 
     // Address of the current processing block in MRAM
-    uint32_t base_tasklet = tasklet_id << BLOCK_SIZE_LOG2;
-    uint32_t mram_base_addr_X = (uint32_t)DPU_MRAM_HEAP_POINTER;
-    uint32_t mram_base_addr_Y = (uint32_t)(DPU_MRAM_HEAP_POINTER + input_size_dpu_bytes_transfer);
-    uint32_t mram_base_addr_res = (uint32_t)(DPU_MRAM_HEAP_POINTER + 2*input_size_dpu_bytes_transfer);
+    uint32_t mram_base_addr_X = mram_tensor(&MRAM_LAYOUT, TENSOR_X);
+    uint32_t mram_base_addr_Y = mram_tensor(&MRAM_LAYOUT, TENSOR_W);
+    uint32_t mram_base_addr_res = mram_tensor(&MRAM_LAYOUT, TENSOR_RESULT);
+    uint32_t mram_base_addr_scales = mram_tensor(&MRAM_LAYOUT, TENSOR_SCALES);
+    uint32_t bits = DPU_INPUT_ARGUMENTS.bits;
+    uint32_t group_size = DPU_INPUT_ARGUMENTS.group_size;
+    uint8_t scales[8] __attribute__((aligned(8)));
+    uint32_t cached_scales = UINT32_MAX;
 
     // Initialize a local cache in WRAM to store the MRAM block
 	uint8_t *cache_X = (uint8_t *) mem_alloc(BLOCK_SIZE);
     uint8_t *cache_Y = (uint8_t *) mem_alloc(BLOCK_SIZE);
-    uint32_t res = 0;
+    int64_t res = 0;
 
-    for(unsigned int byte_index = base_tasklet; byte_index < input_size_dpu_bytes; byte_index += BLOCK_SIZE * NR_TASKLETS){
+    for(uint32_t byte_index = sched_first(tasklet_id, input_size_dpu_bytes); byte_index < input_size_dpu_bytes; byte_index = sched_next(tasklet_id, byte_index)){
         // Bound checking
         //Since there are potentially a tasklet that operates on less than one data_block size
         uint32_t l_size_bytes = (byte_index + BLOCK_SIZE >= input_size_dpu_bytes) ? (input_size_dpu_bytes - byte_index) : BLOCK_SIZE;
 
         // Load cache with current MRAM block
         // MRAM-WRAM TRANSFERS 
-        mram_read((__mram_ptr void const*)(mram_base_addr_X + byte_index), cache_X, l_size_bytes);
-        mram_read((__mram_ptr void const*)(mram_base_addr_Y + byte_index), cache_Y, l_size_bytes);
-
-        for(uint32_t i=0; i<l_size_bytes;i++) {
-            uint8_t a = cache_X[i], b = cache_Y[i];
-            uint32_t global_idx = rank * input_size_dpu_bytes_transfer  + byte_index + i;
-            if(global_idx < N_exact) {
-                for(int p = 0; p < P_BITS; p++) {
-                    uint8_t ba = (a>>p)&1;
-                    if(!ba) continue;
-                    for(int q = 0; q < Q_BITS; q++) {
-                        if((b>>q)&1) {
-                            res += 1U << (p+q);
-                        }
-                    }
-                }
-            } else {
-                for(int p = Thres; p < P_BITS; p++) {
-                    uint8_t ba = (a>>p)&1;
-                    if(!ba) continue;
-                    for(int q = Thres; q < Q_BITS; q++) {
-                        if((b>>q)&1) {
-                            res += 1U << (p+q);
-                        }
-                    }
+        // packed elements land at the end of the cache and are unpacked in place
+        uint32_t packed_bytes = PACKED_BYTES(l_size_bytes, bits);
+        mram_read((__mram_ptr void const*)(mram_base_addr_X + PACKED_BYTES(byte_index, bits)), cache_X + l_size_bytes - packed_bytes, packed_bytes);
+        mram_read((__mram_ptr void const*)(mram_base_addr_Y + PACKED_BYTES(byte_index, bits)), cache_Y + l_size_bytes - packed_bytes, packed_bytes);
+        unpack_block(cache_X, l_size_bytes, bits, DPU_INPUT_ARGUMENTS.signed_x);
+        unpack_block(cache_Y, l_size_bytes, bits, DPU_INPUT_ARGUMENTS.signed_w);
+
+        // bit planes above the highest bit set in the block are empty
+        int planes_x = block_planes(cache_X, l_size_bytes);
+        int planes_y = block_planes(cache_Y, l_size_bytes);
+
+        // one scale group at a time, split where the precision tier changes
+        uint32_t group_bytes = group_size && group_size < l_size_bytes ? group_size : l_size_bytes;
+        uint32_t tier = 0;
+        for(uint32_t offset = 0; offset < l_size_bytes; offset += group_bytes) {
+            // a block sum fits in 32 bits, the running sum of a full MRAM wave does not
+            uint32_t block_res[2] = {0, 0};
+            for(uint32_t i = offset; i < offset + group_bytes; ) {
+                while(tier < nr_tiers - 1 && byte_index + i >= tiers[tier].end)
+                    tier++;
+                uint32_t tier_end = tiers[tier].end - byte_index;
+                uint32_t end = tier < nr_tiers - 1 && tier_end < offset + group_bytes ? tier_end : offset + group_bytes;
+                uint32_t tier_thres = tiers[tier].threshold;
+                if(tier_thres == 0) {
+                    tier_dp(cache_X, cache_Y, i, end, p_bits, q_bits, 0, neg_p, neg_q, planes_x, planes_y, block_res);
+                } else if((int)tier_thres < p_bits && (int)tier_thres < planes_x && (int)tier_thres < planes_y) {
+                    // statistics-only tiers, and blocks without any bit at or above the threshold, have no exact products
+                    tier_dp(cache_X, cache_Y, i, end, p_bits, q_bits, fixed_thres >= 0 ? fixed_thres : (int)tier_thres,
+                            neg_p, neg_q, planes_x, planes_y, block_res);
                 }
+                i = end;
             }
+            int64_t group_res = (int64_t)block_res[0] - block_res[1];
+            res += group_size ? group_res * read_group_scale(mram_base_addr_scales, (byte_index + offset) / group_size, scales, &cached_scales) : group_res;
         }
     }
 
@@ -124,25 +199,47 @@ int main_kernel1() {
     barrier_wait(&my_barrier);
     // only one tasklet do the post-kernel write-back
     if(tasklet_id == 0) { 
-        uint32_t exact = 0;
+        int64_t exact = 0;
         for(int t=0;t<NR_TASKLETS;t++) exact += res_array[t];
 
         uint32_t rank = DPU_INPUT_ARGUMENTS.dpu_rank;
-        uint64_t final = 0;
-        if(rank == 0) {
-            uint64_t approx = 0;
-            for (int p = 0; p < P_BITS; p++) {
-                for (int q = 0; q < Q_BITS; q++) {
-                    if (!(p >= (int)Thres && q >= (int)Thres)) {
-                        uint64_t term = (uint64_t)Sx[p] * Sw[q] / (N-N_exact);
-                        approx += term << (p + q);
+        int64_t final = 0;
+        // the bit statistics are only complete once the last wave has been generated
+        if(rank == 0 && DPU_INPUT_ARGUMENTS.last_wave) {
+            int64_t approx = 0;
+            // every tier approximates its planes below the threshold from its own statistics
+            for (uint32_t t = 0; t < nr_tiers; t++) {
+                const tier_t *tr = &tiers[t];
+                if (tr->threshold == 0 || tr->count == 0)
+                    continue;
+                int64_t tier_approx = 0;
+                for (int p = 0; p < p_bits; p++) {
+                    for (int q = 0; q < q_bits; q++) {
+                        if (!(p >= (int)tr->threshold && q >= (int)tr->threshold)) {
+                            int64_t term = (int64_t)(mul_div_u64(tr->Sx[p], tr->Sw[q], tr->count) << (p + q));
+                            tier_approx += ((p == neg_p) ^ (q == neg_q)) ? -term : term;
+                        }
                     }
                 }
+                // the weight scales enter the approximation through their mean
+                if(group_size)
+                    tier_approx = mul_div_i64(tier_approx, tr->scale_sum, tr->count);
+                approx += tier_approx;
             }
-            final = (uint64_t)exact + approx;
+            final = exact + approx;
         } else {
             final = exact;
         }
+        // -zw * sum(x) - zx * sum(w) + N * zx * zw, computed on the host from the bit statistics
+        if(rank == 0 && DPU_INPUT_ARGUMENTS.last_wave)
+            final += DPU_INPUT_ARGUMENTS.zero_point_correction;
+
+        // running accumulator across streamed waves
+        if(wave > 0) {
+            int64_t acc;
+            mram_read((__mram_ptr void const*)(mram_base_addr_res), &acc, sizeof(acc));
+            final += acc;
+        }
         
         mram_write(&final, (__mram_ptr void*)(mram_base_addr_res), sizeof(final));
     }
@@ -153,3 +250,52 @@ int main_kernel1() {
 	
     return 0;
 }
+
+// main_kernel1: generic, 8 bit planes with the thresholds of the tiers
+int main_kernel1() {
+    return pac_kernel(P_BITS, Q_BITS, -1);
+}
+
+// main_kernel2..5: specialized (bits x bits, threshold), see kernel_specs in support/common.h
+int main_kernel2() {
+    return pac_kernel(8, 8, 4);
+}
+
+int main_kernel3() {
+    return pac_kernel(8, 8, 6);
+}
+
+int main_kernel4() {
+    return pac_kernel(4, 4, 2);
+}
+
+int main_kernel5() {
+    return pac_kernel(2, 2, 1);
+}
+
+// generate_operands: fills the slices of X and W in MRAM from the device generator (support/device_gen.h),
+// packed like the host's transfers
+int generate_operands() {
+    unsigned int tasklet_id = me();
+    if (tasklet_id == 0)
+        mem_reset(); // Reset the heap
+    barrier_wait(&my_barrier);
+
+    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size;
+    uint32_t bits = DPU_INPUT_ARGUMENTS.bits;
+    const device_gen_t *gen = &DPU_INPUT_ARGUMENTS.gen;
+    uint8_t *cache = (uint8_t *) mem_alloc(BLOCK_SIZE);
+
+    for(uint32_t operand = 0; operand < 2; operand++) {
+        uint32_t mram_base_addr = mram_tensor(&MRAM_LAYOUT, operand ? TENSOR_W : TENSOR_X);
+        uint32_t is_signed = operand ? DPU_INPUT_ARGUMENTS.signed_w : DPU_INPUT_ARGUMENTS.signed_x;
+        for(uint32_t byte_index = tasklet_id << BLOCK_SIZE_LOG2; byte_index < input_size_dpu_bytes; byte_index += BLOCK_SIZE * NR_TASKLETS) {
+            uint32_t l_size_bytes = (byte_index + BLOCK_SIZE >= input_size_dpu_bytes) ? (input_size_dpu_bytes - byte_index) : BLOCK_SIZE;
+            device_generate(gen, operand, bits, is_signed, gen->first + byte_index, l_size_bytes, cache);
+            if(bits < 8)
+                pack_elements(cache, cache, l_size_bytes, bits); // in place, every byte is read before it is overwritten
+            mram_write(cache, (__mram_ptr void*)(mram_base_addr + PACKED_BYTES(byte_index, bits)), PACKED_BYTES(l_size_bytes, bits));
+        }
+    }
+    return 0;
+}
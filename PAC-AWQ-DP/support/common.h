@@ -32,34 +32,127 @@
 #define DIV 1 // Shift right to divide by sizeof(T)
 #endif
 
+// Precision tiers: consecutive ranges of the input, from the most salient elements on, each computed
+// exactly above its own threshold and approximated from its own bit statistics below it
+#define MAX_TIERS 4
+typedef struct {
+    uint64_t Sx[8]; // Bit statistics of the tier's elements over the whole input
+    uint64_t Sw[8];
+    uint64_t count; // Elements of the tier over the whole input
+    uint64_t scale_sum; // Sum of the weight scales of the tier's elements
+    uint32_t threshold; // 0: exact, up to the bit planes: the planes below are approximated, bit planes: statistics only
+    uint32_t end; // End of the tier in this DPU's slice (elements)
+} tier_t;
+
+// Parameters of the device generator (-d, support/device_gen.h)
+typedef struct {
+    uint64_t nr_elements; // Elements of the whole input, the rest of the last slice is zero padding
+    uint64_t first; // Global index of the first element of the DPU's slice
+    uint32_t seed;
+    uint32_t type; // enum device_distributions
+    uint32_t param; // relu: zero probability * 2^32, gaussian: DEVICE_SIGMA_SCALE(standard deviation)
+    uint32_t padding;
+} device_gen_t;
+
 // Structures used by both the host and the dpu to communicate information
 typedef struct {
     uint32_t size;
-    uint32_t transfer_size;
 	enum kernels {
-	    kernel1 = 0,
-	    nr_kernels = 1,
+	    kernel1 = 0, // Generic, 8 bit planes, runtime threshold
+	    kernel2 = 1, // Unrolled for 8x8 bit planes, threshold 4
+	    kernel3 = 2, // Unrolled for 8x8 bit planes, threshold 6
+	    kernel4 = 3, // Unrolled for 4x4 bit planes (-b 4), threshold 2
+	    kernel5 = 4, // Unrolled for 2x2 bit planes (-b 2), threshold 1
+	    nr_kernels = 5,
 	} kernel;
-	uint32_t threshold;
-	uint32_t total_elements;
-	uint32_t Sx[8];
-	uint32_t Sw[8];
 	uint32_t dpu_rank;
-
-	uint32_t exact_count;
-	uint32_t hybrid_count;
-	uint32_t num_exact_dpus;
+	uint32_t wave; // Index of the streamed wave (wave 0 resets the accumulator)
+	uint32_t last_wave; // Set on the final wave, when the tiers' Sx and Sw are complete
+	uint64_t total_elements;
+	uint32_t nr_tiers;
+	tier_t tiers[MAX_TIERS];
+	uint32_t signed_x; // Two's-complement activations
+	uint32_t signed_w; // Two's-complement weights
+	int64_t zero_point_correction; // Added by DPU 0 on the last wave
+	uint32_t bits; // Element width in MRAM: 8, or 4/2 packed (support/packing.h)
+	uint32_t group_size; // Elements per weight scale, 0 without scales
+	uint32_t generate; // Fill X and W from the device generator instead of running the kernel
+	device_gen_t gen;
 } dpu_arguments_t; // Input arguments
 
+// Element width and threshold each kernel is specialized for, 0 for the generic kernel (host only)
+typedef struct {
+    uint32_t bits;
+    uint32_t threshold;
+} kernel_spec_t;
+#define KERNEL_SPECS {{0, 0}, {8, 4}, {8, 6}, {4, 2}, {2, 1}}
+
 typedef struct {
     uint64_t count;
 } dpu_results_t; // Results (cycle count)
 
 #define ANSI_COLOR_RED     "\x1b[31m"
 #define ANSI_COLOR_GREEN   "\x1b[32m"
+#define ANSI_COLOR_YELLOW  "\x1b[33m"
 #define ANSI_COLOR_RESET   "\x1b[0m"
 
 #define divceil(n, m) (((n)-1) / (m) + 1)
 #define roundup(n, m) ((n / m) * m + m)
 
+// Largest per-DPU wave (bytes per operand) that fits X, Y and the 8-byte accumulator in 64 MB of MRAM
+#define MRAM_SIZE (64 << 20)
+#define MAX_WAVE_SIZE_DPU (((MRAM_SIZE - 8) / 2) & ~7)
+
+// Signed operands are two's complement: the top of planes bit planes weighs -2^(planes-1) (MSB negation).
+// Narrow elements are sign-extended, so any number of planes from their width up gives the same value
+#define MSB_NEGATED(p, is_signed, planes) ((is_signed) && (p) == (int)(planes) - 1)
+
+// Sum of the values of an operand, from its bit statistics
+static inline int64_t bit_stats_sum(const uint64_t S[8], uint32_t is_signed) {
+    int64_t sum = 0;
+    for(int b = 0; b < 8; b++)
+        sum += (MSB_NEGATED(b, is_signed, 8) ? -(int64_t)S[b] : (int64_t)S[b]) * (1 << b);
+    return sum;
+}
+
+// Zero-point correction terms: sum (x - zx) * (w - zw) = sum x * w - zw * sum x - zx * sum w + N * zx * zw
+static inline int64_t zero_point_correction(const uint64_t Sx[8], const uint64_t Sw[8], uint64_t N,
+                                            uint32_t signed_x, uint32_t signed_w, int32_t zx, int32_t zw) {
+    return -(int64_t)zw * bit_stats_sum(Sx, signed_x) - (int64_t)zx * bit_stats_sum(Sw, signed_w) + (int64_t)N * zx * zw;
+}
+
+// floor(a * b / n) without overflowing the 64-bit product (bit statistics of streamed inputs exceed 32 bits)
+static inline uint64_t mul_div_u64(uint64_t a, uint64_t b, uint64_t n) {
+    uint64_t a_lo = a & 0xFFFFFFFF, a_hi = a >> 32;
+    uint64_t b_lo = b & 0xFFFFFFFF, b_hi = b >> 32;
+    if(a_hi == 0 && b_hi == 0)
+        return a * b / n;
+    // 128-bit product as hi:lo
+    uint64_t mid1 = a_hi * b_lo, mid2 = a_lo * b_hi;
+    uint64_t lo = a_lo * b_lo;
+    uint64_t hi = a_hi * b_hi + (mid1 >> 32) + (mid2 >> 32);
+    uint64_t t = lo + (mid1 << 32);
+    hi += t < lo;
+    lo = t + (mid2 << 32);
+    hi += lo < t;
+    if(hi == 0)
+        return lo / n;
+    // Restoring long division, the quotient fits in 64 bits since a, b <= n
+    uint64_t q = 0, r = hi % n;
+    for(int i = 63; i >= 0; i--) {
+        uint64_t carry = r >> 63;
+        r = (r << 1) | ((lo >> i) & 1);
+        if(carry || r >= n) {
+            r -= n;
+            q |= 1ULL << i;
+        }
+    }
+    return q;
+}
+
+// Signed a * b / n, rounding the magnitude down
+static inline int64_t mul_div_i64(int64_t a, uint64_t b, uint64_t n) {
+    return a < 0 ? -(int64_t)mul_div_u64((uint64_t)-a, b, n) : (int64_t)mul_div_u64((uint64_t)a, b, n);
+}
+
 #endif
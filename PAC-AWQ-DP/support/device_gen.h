@@ -0,0 +1,117 @@
+#ifndef _DEVICE_GEN_H_
+#define _DEVICE_GEN_H_
+
+#include <stdint.h>
+
+/*
+ * Device generation (-d SEED)
+ *
+ * Every DPU fills its slices of X and W in MRAM itself, once before the first launch, so that kernel-only runs
+ * neither wait for the host generator nor push the operands. The elements come from a counter-based PRNG: a
+ * xorshift32 stream per operand and group of DEVICE_GEN_GROUP elements, seeded by a hash of the seed and the
+ * global group index, so any DPU or tasklet generates any slice independently and the host reproduces the
+ * same elements for its reference and the bit statistics. Integer only, without multiplies but one per
+ * Gaussian element (the DPU has no FPU and multiplies in software). The distributions are those of
+ * support/generators.h, drawn differently:
+ *   binary   : 0/1 values
+ *   uniform  : uniform 8-bit values
+ *   relu     : activations zero with probability param, else |N(0, 32)|, weights 128 + N(0, 32)
+ *   gaussian : 128 + N(0, param) for both
+ * with the zero-point 128 dropped and the values clamped to [-128, 127] for signed operands.
+ * N(0, sigma) is the centered sum of four uniform bytes scaled by sigma / 147.8, their standard deviation.
+ * Narrow elements keep the top bits, like the host generators, signed 1-bit ones are -1/+1. Elements from
+ * nr_elements on are zero padding.
+ */
+
+enum device_distributions { // in the order of enum generator_type
+    DEVICE_BINARY = 0,
+    DEVICE_UNIFORM,
+    DEVICE_RELU,
+    DEVICE_GAUSSIAN,
+};
+
+#define DEVICE_GEN_GROUP 8 // Elements per random stream, 8-byte aligned slices start at a group
+#define DEVICE_SIGMA_SCALE(sigma) ((uint32_t)((sigma) * 65536.0 / 147.8 + 0.5)) // sigma in 16-bit fixed point, per unit of the byte sum
+#define DEVICE_RELU_SIGMA 14189 // DEVICE_SIGMA_SCALE(32)
+
+// Thomas Wang's 32-bit integer hash, shifts and adds only
+static inline uint32_t device_hash(uint32_t key) {
+    key = ~key + (key << 15);
+    key = key ^ (key >> 12);
+    key = key + (key << 2);
+    key = key ^ (key >> 4);
+    key = key + (key << 3) + (key << 11);
+    key = key ^ (key >> 16);
+    return key;
+}
+
+static inline uint32_t device_xorshift(uint32_t *state) {
+    uint32_t x = *state;
+    x ^= x << 13;
+    x ^= x >> 17;
+    x ^= x << 5;
+    return *state = x;
+}
+
+// First state of the stream of a group of elements of X (operand 0) or W (operand 1)
+static inline uint32_t device_stream(const device_gen_t *g, uint32_t operand, uint64_t group) {
+    uint32_t state = device_hash(device_hash(g->seed ^ device_hash(operand + 1)) + (uint32_t)(group >> 32)) ^ (uint32_t)group;
+    state = device_hash(state);
+    return state ? state : 1; // xorshift never leaves 0
+}
+
+// N(0, sigma) from the four bytes of r, sigma_scale = DEVICE_SIGMA_SCALE(sigma)
+static inline int32_t device_gaussian(uint32_t r, uint32_t sigma_scale) {
+    int32_t sum = (int32_t)((r & 0xff) + ((r >> 8) & 0xff) + ((r >> 16) & 0xff) + (r >> 24)) - 510;
+    return (sum * (int32_t)sigma_scale) >> 16;
+}
+
+// Saturates v to the range of the operand, [0, 255] or [-128, 127] if is_signed
+static inline uint8_t device_clamp(int32_t v, uint32_t is_signed) {
+    if(is_signed)
+        return (uint8_t)(int8_t)(v < -128 ? -128 : (v > 127 ? 127 : v));
+    return v < 0 ? 0 : (v > 255 ? 255 : (uint8_t)v);
+}
+
+// Elements [first, first + n) of X (operand 0) or W (operand 1) of bits bits into out, one byte each
+void device_generate(const device_gen_t *g, uint32_t operand, uint32_t bits, uint32_t is_signed, uint64_t first, uint32_t n, uint8_t *out) {
+    uint32_t state = 0;
+    for(uint32_t i = 0; i < n; i++) {
+        uint64_t index = first + i;
+        if(i == 0 || index % DEVICE_GEN_GROUP == 0) {
+            // every element draws two numbers, a slice starting inside a group skips those of the elements before it
+            state = device_stream(g, operand, index / DEVICE_GEN_GROUP);
+            for(uint32_t skip = 0; skip < 2 * (index % DEVICE_GEN_GROUP); skip++)
+                device_xorshift(&state);
+        }
+        uint32_t r1 = device_xorshift(&state), r2 = device_xorshift(&state);
+        int32_t zero_point = is_signed ? 0 : 128;
+        uint8_t v;
+        switch(g->type) {
+        case DEVICE_BINARY:
+            v = r1 >> 31;
+            break;
+        case DEVICE_UNIFORM:
+            v = r1 >> 24;
+            break;
+        case DEVICE_RELU:
+            if(operand == 0) {
+                int32_t a = device_gaussian(r2, DEVICE_RELU_SIGMA);
+                v = r1 < g->param ? 0 : device_clamp(a < 0 ? -a : a, is_signed);
+            } else {
+                v = device_clamp(zero_point + device_gaussian(r2, DEVICE_RELU_SIGMA), is_signed);
+            }
+            break;
+        default:
+            v = device_clamp(zero_point + device_gaussian(r2, g->param), is_signed);
+            break;
+        }
+        if(bits && bits < 8 && g->type != DEVICE_BINARY)
+            v = is_signed ? (uint8_t)((int8_t)v >> (8 - bits)) : v >> (8 - bits);
+        if(bits == 1 && is_signed)
+            v = v & 1 ? 1 : 0xff;
+        out[i] = index < g->nr_elements ? v : 0;
+    }
+}
+
+#endif
@@ -12,38 +12,131 @@
 
 #include "../support/common.h"
 #include "../support/cyclecount.h"
+#include "../support/sched.h"
+#include "../support/packing.h"
+#include "../support/device_gen.h"
+#include "../support/mram_layout.h"
+#include "../support/sparse.h"
 
 
 #define P_BITS 8
 #define Q_BITS 8
 
+// Full unrolling of the bit-plane loops of the specialized kernels
+#ifdef __clang__
+#define UNROLL _Pragma("unroll")
+#else
+#define UNROLL
+#endif
+
 // Input and output arguments
 __host dpu_arguments_t DPU_INPUT_ARGUMENTS;
 __host dpu_results_t DPU_RESULTS[NR_TASKLETS];
+__host mram_layout_t MRAM_LAYOUT; // Tensor table, pushed once by the host
 
 // Barrier
 BARRIER_INIT(my_barrier, NR_TASKLETS);
 
 extern int main_kernel1(void);
-int (*kernels[nr_kernels])(void) = {main_kernel1};
+extern int main_kernel2(void);
+extern int main_kernel3(void);
+extern int main_kernel4(void);
+extern int main_kernel5(void);
+extern int main_kernel6(void);
+extern int main_kernel7(void);
+int (*kernels[nr_kernels])(void) = {main_kernel1, main_kernel2, main_kernel3, main_kernel4, main_kernel5, main_kernel6, main_kernel7};
+extern int generate_operands(void);
 int main(void) { 
+    // Device generation (-d), once before the first kernel
+    if(DPU_INPUT_ARGUMENTS.generate)
+        return generate_operands();
     // Kernel
     return kernels[DPU_INPUT_ARGUMENTS.kernel](); 
 }
 
 
 
-static uint32_t res_array[NR_TASKLETS];
+static int64_t res_array[NR_TASKLETS];
 
+// Weight scale of a group, read with the 7 that follow it since MRAM reads are 8-byte aligned
+static uint8_t read_group_scale(uint32_t mram_base_addr_scales, uint32_t group, uint8_t scales[8], uint32_t *cached) {
+    if((group & ~7) != *cached) {
+        *cached = group & ~7;
+        mram_read((__mram_ptr void const*)(mram_base_addr_scales + *cached), scales, 8);
+    }
+    return scales[group & 7];
+}
 
-// main_kernel1
-int main_kernel1() {
+// Bit planes in use by the bytes OR-ed into the 32-bit word v: the position of their highest bit set
+static uint32_t word_planes(uint32_t v) {
+    v |= v >> 16;
+    v |= v >> 8;
+    v &= 0xff;
+    return v ? 32 - __builtin_clz(v) : 0;
+}
+
+// Bit planes in use by a cached block: the position of the highest bit set in any of its elements.
+// n is a multiple of 8 and the cache 8-byte aligned, so the OR-reduction runs over 32-bit words
+static uint32_t block_planes(const uint8_t *cache, uint32_t n) {
+    const uint32_t *words = (const uint32_t *)cache;
+    uint32_t v = 0;
+    for(uint32_t i = 0; i < n / 4; i++)
+        v |= words[i];
+    return word_planes(v);
+}
+
+// Bit planes in use by the elements of a cached run-length segment, the odd bytes of its n bytes of pairs
+static uint32_t rle_planes(const uint8_t *cache, uint32_t n) {
+    const uint32_t *words = (const uint32_t *)cache;
+    uint32_t v = 0;
+    for(uint32_t i = 0; i < n / 4; i++)
+        v |= words[i];
+    return word_planes((v & 0xff00ff00) >> 8);
+}
+
+// Exact products of the element pair (a, b) over the planes from thres up to the highest ones in use,
+// into block_res[0], and into block_res[1] for the products of one negated bit plane
+static inline __attribute__((always_inline)) void pac_pair(uint8_t a, uint8_t b, const int p_bits, const int q_bits, const uint32_t thres,
+                                                          int planes_x, int planes_y, int neg_p, int neg_q, uint32_t block_res[2]) {
+    UNROLL
+    for (int p = thres; p < p_bits; p++) {
+        if (p >= planes_x) break;
+        if (!((a>>p)&1)) continue;
+        UNROLL
+        for (int q = thres; q < q_bits; q++) {
+            if (q >= planes_y) break;
+            if ((b>>q)&1) {
+                block_res[(p == neg_p) ^ (q == neg_q)] += 1 << (p + q);
+            }
+        }
+    }
+}
+
+// Exact products of the element pair (a, b) on the plane pairs with p + q == sum only, a progressive pass (-r)
+static inline __attribute__((always_inline)) void pac_level_pair(uint8_t a, uint8_t b, const int p_bits, const int q_bits, const uint32_t thres,
+                                                                int sum, int planes_x, int planes_y, int neg_p, int neg_q, uint32_t block_res[2]) {
+    int top_x = (planes_x < p_bits ? planes_x : p_bits) - 1;
+    int top_y = (planes_y < q_bits ? planes_y : q_bits) - 1;
+    int first = sum - top_y > (int)thres ? sum - top_y : (int)thres;
+    int last = sum - (int)thres < top_x ? sum - (int)thres : top_x;
+    for (int p = first; p <= last; p++) {
+        int q = sum - p;
+        if ((a >> p) & (b >> q) & 1)
+            block_res[(p == neg_p) ^ (q == neg_q)] += 1 << sum;
+    }
+}
+
+// PAC over p_bits x q_bits bit planes with threshold thres, on operands in format (support/sparse.h).
+// The specialized kernels pass constants, so that the bit-plane loops are unrolled and the plane
+// weights and signs are folded at compile time, and every kernel keeps only its format's block loop
+static inline __attribute__((always_inline)) int pac_kernel(const int p_bits, const int q_bits, const uint32_t thres, const uint32_t format) {
     unsigned int tasklet_id = me();
 #if PRINT
     printf("tasklet_id = %u\n", tasklet_id);
 #endif
     if (tasklet_id == 0){ 
         mem_reset(); // Reset the heap
+        sched_init(); // Reset the block distribution
 #ifdef CYCLES
         perfcounter_config(COUNT_CYCLES, true); // Initialize once the cycle counter
 #elif INSTRUCTIONS
@@ -55,52 +148,140 @@ int main_kernel1() {
 #if defined(CYCLES) || defined(INSTRUCTIONS)
     perfcounter_count count;
     dpu_results_t *result = &DPU_RESULTS[tasklet_id];
-    result->count = 0;
+    if(DPU_INPUT_ARGUMENTS.wave == 0) result->count = 0; // Streamed waves accumulate their counts
     counter_start(&count); // START TIMER
 #endif
 
-    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size; // Input size per DPU in bytes
-    uint32_t input_size_dpu_bytes_transfer = DPU_INPUT_ARGUMENTS.transfer_size; // Transfer input size per DPU in bytes
-    uint32_t Thres = DPU_INPUT_ARGUMENTS.threshold;
-    uint32_t N = DPU_INPUT_ARGUMENTS.total_elements;
-    uint32_t *Sx = DPU_INPUT_ARGUMENTS.Sx;
-    uint32_t *Sw = DPU_INPUT_ARGUMENTS.Sw;
+    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size; // Input size per DPU in bytes (elements when packed)
+    uint64_t N = DPU_INPUT_ARGUMENTS.total_elements;
+    uint64_t *Sx = DPU_INPUT_ARGUMENTS.Sx;
+    uint64_t *Sw = DPU_INPUT_ARGUMENTS.Sw;
+    uint32_t wave = DPU_INPUT_ARGUMENTS.wave;
+    uint32_t level = DPU_INPUT_ARGUMENTS.level;
+    // bit planes weighing -2^(bits-1) (p_bits/q_bits never match for unsigned operands)
+    int neg_p = DPU_INPUT_ARGUMENTS.signed_x ? p_bits - 1 : p_bits;
+    int neg_q = DPU_INPUT_ARGUMENTS.signed_w ? q_bits - 1 : q_bits;
 
 
 
 
     // Address of the current processing block in MRAM
-    uint32_t base_tasklet = tasklet_id << BLOCK_SIZE_LOG2;
-    uint32_t mram_base_addr_X = (uint32_t)DPU_MRAM_HEAP_POINTER;
-    uint32_t mram_base_addr_Y = (uint32_t)(DPU_MRAM_HEAP_POINTER + input_size_dpu_bytes_transfer);
-    uint32_t mram_base_addr_res = (uint32_t)(DPU_MRAM_HEAP_POINTER + 2*input_size_dpu_bytes_transfer);
+    uint32_t mram_base_addr_X = mram_tensor(&MRAM_LAYOUT, TENSOR_X);
+    uint32_t mram_base_addr_Y = mram_tensor(&MRAM_LAYOUT, TENSOR_W);
+    uint32_t mram_base_addr_res = mram_tensor(&MRAM_LAYOUT, TENSOR_RESULT);
+    uint32_t mram_base_addr_scales = mram_tensor(&MRAM_LAYOUT, TENSOR_SCALES);
+    uint32_t bits = DPU_INPUT_ARGUMENTS.bits;
+    uint32_t group_size = DPU_INPUT_ARGUMENTS.group_size;
+    uint8_t scales[8] __attribute__((aligned(8)));
+    uint32_t cached_scales = UINT32_MAX;
 
     // Initialize a local cache in WRAM to store the MRAM block
 	uint8_t *cache_X = (uint8_t *) mem_alloc(BLOCK_SIZE);
     uint8_t *cache_Y = (uint8_t *) mem_alloc(BLOCK_SIZE);
-    uint32_t res = 0;
+    int64_t res = 0;
+
+    for(uint32_t byte_index = sched_first(tasklet_id, input_size_dpu_bytes); byte_index < input_size_dpu_bytes; byte_index = sched_next(tasklet_id, byte_index)){
+        if(format != SPARSE_NONE) {
+            // the two compressed segments of the block, their table entries are adjacent
+            uint32_t segment = byte_index / SPARSE_SEGMENT;
+            sparse_block_t table_x[2], table_y[2];
+            mram_read((__mram_ptr void const*)(mram_base_addr_X + segment * sizeof(sparse_block_t)), table_x, sizeof(table_x));
+            mram_read((__mram_ptr void const*)(mram_base_addr_Y + segment * sizeof(sparse_block_t)), table_y, sizeof(table_y));
+            for(uint32_t s = 0; s < 2 && (segment + s) * SPARSE_SEGMENT < input_size_dpu_bytes; s++) {
+                uint32_t nnz_x = table_x[s].nnz, nnz_y = table_y[s].nnz;
+                if(nnz_x == 0 || nnz_y == 0)
+                    continue;
+                uint32_t bytes_x = sparse_segment_bytes(format, nnz_x);
+                uint32_t bytes_y = sparse_segment_bytes(format, nnz_y);
+                mram_read((__mram_ptr void const*)(mram_base_addr_X + table_x[s].offset), cache_X, bytes_x);
+                mram_read((__mram_ptr void const*)(mram_base_addr_Y + table_y[s].offset), cache_Y, bytes_y);
+                uint32_t block_res[2] = {0, 0};
+                if(format == SPARSE_BITMAP) {
+                    // pairs of non-zero elements are the set bits of both bitmaps, an element's rank
+                    // among the non-zero ones is the count of bits set below it
+                    const uint32_t *bitmap_x = (const uint32_t *)cache_X, *bitmap_y = (const uint32_t *)cache_Y;
+                    const uint8_t *values_x = cache_X + SPARSE_BITMAP_BYTES, *values_y = cache_Y + SPARSE_BITMAP_BYTES;
+                    int planes_x = block_planes(values_x, bytes_x - SPARSE_BITMAP_BYTES);
+                    int planes_y = block_planes(values_y, bytes_y - SPARSE_BITMAP_BYTES);
+                    if(planes_x <= (int)thres || planes_y <= (int)thres)
+                        continue;
+                    uint32_t rank_x = 0, rank_y = 0;
+                    for(uint32_t w = 0; w < SPARSE_BITMAP_BYTES / 4; w++) {
+                        uint32_t both = bitmap_x[w] & bitmap_y[w];
+                        while(both) {
+                            uint32_t below = (both & -both) - 1;
+                            pac_pair(values_x[rank_x + __builtin_popcount(bitmap_x[w] & below)],
+                                     values_y[rank_y + __builtin_popcount(bitmap_y[w] & below)],
+                                     p_bits, q_bits, thres, planes_x, planes_y, neg_p, neg_q, block_res);
+                            both &= both - 1;
+                        }
+                        rank_x += __builtin_popcount(bitmap_x[w]);
+                        rank_y += __builtin_popcount(bitmap_y[w]);
+                    }
+                } else {
+                    // merge of the two runs by element position, a pair sits skip + 1 elements after the previous one
+                    int planes_x = rle_planes(cache_X, bytes_x);
+                    int planes_y = rle_planes(cache_Y, bytes_y);
+                    if(planes_x <= (int)thres || planes_y <= (int)thres)
+                        continue;
+                    uint32_t i_x = 0, i_y = 0;
+                    uint32_t pos_x = cache_X[0], pos_y = cache_Y[0];
+                    while(i_x < nnz_x && i_y < nnz_y) {
+                        if(pos_x == pos_y)
+                            pac_pair(cache_X[2 * i_x + 1], cache_Y[2 * i_y + 1],
+                                     p_bits, q_bits, thres, planes_x, planes_y, neg_p, neg_q, block_res);
+                        if(pos_x <= pos_y) {
+                            if(++i_x < nnz_x)
+                                pos_x += cache_X[2 * i_x] + 1;
+                        } else if(++i_y < nnz_y) {
+                            pos_y += cache_Y[2 * i_y] + 1;
+                        }
+                    }
+                }
+                res += (int64_t)block_res[0] - block_res[1];
+            }
+            continue;
+        }
 
-    for(unsigned int byte_index = base_tasklet; byte_index < input_size_dpu_bytes; byte_index += BLOCK_SIZE * NR_TASKLETS){
         // Bound checking
         //Since there are potentially a tasklet that operates on less than one data_block size
         uint32_t l_size_bytes = (byte_index + BLOCK_SIZE >= input_size_dpu_bytes) ? (input_size_dpu_bytes - byte_index) : BLOCK_SIZE;
 
         // Load cache with current MRAM block
         // MRAM-WRAM TRANSFERS 
-        mram_read((__mram_ptr void const*)(mram_base_addr_X + byte_index), cache_X, l_size_bytes);
-        mram_read((__mram_ptr void const*)(mram_base_addr_Y + byte_index), cache_Y, l_size_bytes);
+        // packed elements land at the end of the cache and are unpacked in place
+        uint32_t packed_bytes = PACKED_BYTES(l_size_bytes, bits);
+        mram_read((__mram_ptr void const*)(mram_base_addr_X + PACKED_BYTES(byte_index, bits)), cache_X + l_size_bytes - packed_bytes, packed_bytes);
+        mram_read((__mram_ptr void const*)(mram_base_addr_Y + PACKED_BYTES(byte_index, bits)), cache_Y + l_size_bytes - packed_bytes, packed_bytes);
+        unpack_block(cache_X, l_size_bytes, bits, DPU_INPUT_ARGUMENTS.signed_x);
+        unpack_block(cache_Y, l_size_bytes, bits, DPU_INPUT_ARGUMENTS.signed_w);
+
+        // bit planes above the highest bit set in the block are empty, and a block without
+        // any bit at or above the threshold has no exact products at all
+        int planes_x = block_planes(cache_X, l_size_bytes);
+        int planes_y = block_planes(cache_Y, l_size_bytes);
+        if(planes_x <= (int)thres || planes_y <= (int)thres)
+            continue;
+        // a progressive pass also skips the blocks whose highest planes fall short of its level
+        if(level && planes_x + planes_y - 2 < (int)level - 1)
+            continue;
 
         // for each tasklet - do the precise computing - all in parallel!
-        for(uint32_t i=0; i<l_size_bytes;i++) {
-            uint8_t a = cache_X[i], b = cache_Y[i];
-            for (int p = Thres; p < P_BITS; p++) {
-                if (!((a>>p)&1)) continue;
-                for (int q = Thres; q < Q_BITS; q++) {
-                    if ((b>>q)&1) {
-                        res += 1 << (p + q);
-                    }
-                }
+        // one scale group at a time
+        uint32_t group_bytes = group_size && group_size < l_size_bytes ? group_size : l_size_bytes;
+        for(uint32_t offset = 0; offset < l_size_bytes; offset += group_bytes) {
+            // a block sum fits in 32 bits, the running sum of a full MRAM wave does not
+            // block_res[1] collects the products of one negated bit plane
+            uint32_t block_res[2] = {0, 0};
+            if(level) {
+                for(uint32_t i=offset; i<offset+group_bytes;i++)
+                    pac_level_pair(cache_X[i], cache_Y[i], p_bits, q_bits, thres, level - 1, planes_x, planes_y, neg_p, neg_q, block_res);
+            } else {
+                for(uint32_t i=offset; i<offset+group_bytes;i++)
+                    pac_pair(cache_X[i], cache_Y[i], p_bits, q_bits, thres, planes_x, planes_y, neg_p, neg_q, block_res);
             }
+            int64_t group_res = (int64_t)block_res[0] - block_res[1];
+            res += group_size ? group_res * read_group_scale(mram_base_addr_scales, (byte_index + offset) / group_size, scales, &cached_scales) : group_res;
         }
         
     }
@@ -111,26 +292,40 @@ int main_kernel1() {
     barrier_wait(&my_barrier);
     // only one tasklet do the post-kernel write-back
     if(tasklet_id == 0) { 
-        uint32_t exact = 0;
+        int64_t exact = 0;
         for(int t=0;t<NR_TASKLETS;t++) exact += res_array[t];
 
 
         uint32_t rank = DPU_INPUT_ARGUMENTS.dpu_rank;
-        uint64_t final = 0;
-        if(rank == 0) {
-            uint64_t approx = 0;
-            for (int p = 0; p < P_BITS; p++) {
-                for (int q = 0; q < Q_BITS; q++) {
-                    if (!(p >= (int)Thres && q >= (int)Thres)) {
-                        uint64_t term = (uint64_t)Sx[p] * Sw[q] / N;
-                        approx += term << (p + q);
+        int64_t final = 0;
+        // the bit statistics are only complete once the last wave has been generated
+        if(rank == 0 && DPU_INPUT_ARGUMENTS.last_wave) {
+            int64_t approx = 0;
+            for (int p = 0; p < p_bits; p++) {
+                for (int q = 0; q < q_bits; q++) {
+                    if (!(p >= (int)thres && q >= (int)thres)) {
+                        int64_t term = (int64_t)(mul_div_u64(Sx[p], Sw[q], N) << (p + q));
+                        approx += ((p == neg_p) ^ (q == neg_q)) ? -term : term;
                     }
                 }
             }
-            final = (uint64_t)exact + approx;
+            // the weight scales enter the approximation through their mean
+            if(group_size)
+                approx = mul_div_i64(approx, DPU_INPUT_ARGUMENTS.scale_sum, N);
+            final = exact + approx;
         } else {
             final = exact;
         }
+        // -zw * sum(x) - zx * sum(w) + N * zx * zw, computed on the host from the bit statistics
+        if(rank == 0 && DPU_INPUT_ARGUMENTS.last_wave)
+            final += DPU_INPUT_ARGUMENTS.zero_point_correction;
+
+        // running accumulator across streamed waves
+        if(wave > 0) {
+            int64_t acc;
+            mram_read((__mram_ptr void const*)(mram_base_addr_res), &acc, sizeof(acc));
+            final += acc;
+        }
         
         mram_write(&final, (__mram_ptr void*)(mram_base_addr_res), sizeof(final));
     }
@@ -141,3 +336,61 @@ int main_kernel1() {
 	
     return 0;
 }
+
+// main_kernel1: generic, 8 bit planes with the threshold from the host
+int main_kernel1() {
+    return pac_kernel(P_BITS, Q_BITS, DPU_INPUT_ARGUMENTS.threshold, SPARSE_NONE);
+}
+
+// main_kernel2..5: specialized (bits x bits, threshold), see kernel_specs in support/common.h
+int main_kernel2() {
+    return pac_kernel(8, 8, 4, SPARSE_NONE);
+}
+
+int main_kernel3() {
+    return pac_kernel(8, 8, 6, SPARSE_NONE);
+}
+
+int main_kernel4() {
+    return pac_kernel(4, 4, 2, SPARSE_NONE);
+}
+
+int main_kernel5() {
+    return pac_kernel(2, 2, 1, SPARSE_NONE);
+}
+
+// main_kernel6/7: generic, 8 bit planes, on bitmap or run-length compressed operands
+int main_kernel6() {
+    return pac_kernel(P_BITS, Q_BITS, DPU_INPUT_ARGUMENTS.threshold, SPARSE_BITMAP);
+}
+
+int main_kernel7() {
+    return pac_kernel(P_BITS, Q_BITS, DPU_INPUT_ARGUMENTS.threshold, SPARSE_RLE);
+}
+
+// generate_operands: fills the slices of X and W in MRAM from the device generator (support/device_gen.h),
+// packed like the host's transfers
+int generate_operands() {
+    unsigned int tasklet_id = me();
+    if (tasklet_id == 0)
+        mem_reset(); // Reset the heap
+    barrier_wait(&my_barrier);
+
+    uint32_t input_size_dpu_bytes = DPU_INPUT_ARGUMENTS.size;
+    uint32_t bits = DPU_INPUT_ARGUMENTS.bits;
+    const device_gen_t *gen = &DPU_INPUT_ARGUMENTS.gen;
+    uint8_t *cache = (uint8_t *) mem_alloc(BLOCK_SIZE);
+
+    for(uint32_t operand = 0; operand < 2; operand++) {
+        uint32_t mram_base_addr = mram_tensor(&MRAM_LAYOUT, operand ? TENSOR_W : TENSOR_X);
+        uint32_t is_signed = operand ? DPU_INPUT_ARGUMENTS.signed_w : DPU_INPUT_ARGUMENTS.signed_x;
+        for(uint32_t byte_index = tasklet_id << BLOCK_SIZE_LOG2; byte_index < input_size_dpu_bytes; byte_index += BLOCK_SIZE * NR_TASKLETS) {
+            uint32_t l_size_bytes = (byte_index + BLOCK_SIZE >= input_size_dpu_bytes) ? (input_size_dpu_bytes - byte_index) : BLOCK_SIZE;
+            device_generate(gen, operand, bits, is_signed, gen->first + byte_index, l_size_bytes, cache);
+            if(bits < 8)
+                pack_elements(cache, cache, l_size_bytes, bits); // in place, every byte is read before it is overwritten
+            mram_write(cache, (__mram_ptr void*)(mram_base_addr + PACKED_BYTES(byte_index, bits)), PACKED_BYTES(l_size_bytes, bits));
+        }
+    }
+    return 0;
+}
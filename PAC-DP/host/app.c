@@ -16,6 +16,12 @@
 #include "../support/common.h"
 #include "../support/timer.h"
 #include "../support/params.h"
+#include "../support/tensor_file.h"
+#include "../support/generators.h"
+#include "../support/packing.h"
+#include "../support/sparse.h"
+#include "../support/mram_layout.h"
+#include "../support/stream.h"
 
 // Define the DPU Binary path as DPU_BINARY here
 #ifndef DPU_BINARY
@@ -30,18 +36,8 @@
 // Pointer declaration
 static uint8_t* X;
 static uint8_t* Y;
-static uint64_t* Y_host;
-static uint64_t res = 0;
-
-// Create input arrays
-static void read_input(uint8_t* A, uint8_t* B, unsigned int nr_elements) {
-    srand(0);
-    printf("nr_elements\t%u\n", nr_elements);
-    for (unsigned int i = 0; i < nr_elements; i++) {
-        A[i] = (uint8_t) (rand() % 2);
-        B[i] = (uint8_t) (rand() % 2);
-    }
-}
+static int64_t* Y_host;
+static int64_t res = 0;
 
 // Compute output in the host for verification purposes
 /*
@@ -51,16 +47,9 @@ static void read_input(uint8_t* A, uint8_t* B, unsigned int nr_elements) {
  * Thres : threshold for digital/Analog domain
 */
 
-void pac_bitwise_dp(const uint8_t* X,
-                        const uint8_t* W,
-                        unsigned int N,
-                        unsigned int Thres,
-                        uint64_t* res) 
-{
-    uint32_t Sx[P_BITS] = {0};
-    uint32_t Sw[Q_BITS] = {0};
-    // bit level sparsity collection
-    for(unsigned int i=0; i< N;i++) {
+// bit level sparsity collection, accumulated into Sx/Sw
+static void bit_stats(const uint8_t* X, const uint8_t* W, uint64_t N, uint64_t Sx[P_BITS], uint64_t Sw[Q_BITS]) {
+    for(uint64_t i=0; i< N;i++) {
         uint8_t x = X[i];
         uint8_t w = W[i];
         for(int p = 0 ; p < P_BITS; p++ ) {
@@ -70,31 +59,86 @@ void pac_bitwise_dp(const uint8_t* X,
             Sw[q] += (w >> q) & 1;
         }
     }
-    // accurate computing part
-    uint64_t exact = 0;
-    for(unsigned int i=0; i<N; i++) {
+}
+
+// bit statistics over the pairs of non-zero elements, the only products the sparse kernels see, and their count
+static void pair_bit_stats(const uint8_t* X, const uint8_t* W, uint64_t N, uint64_t Sx[P_BITS], uint64_t Sw[Q_BITS], uint64_t *pairs) {
+    for(uint64_t i=0; i< N;i++) {
+        uint8_t x = X[i];
+        uint8_t w = W[i];
+        if(!x || !w)
+            continue;
+        (*pairs)++;
+        for(int p = 0 ; p < P_BITS; p++ ) {
+            Sx[p] += (x >> p) & 1;
+        }
+        for(int q = 0; q < Q_BITS; q++) {
+            Sw[q] += (w >> q) & 1;
+        }
+    }
+}
+
+// accurate computing part
+static int64_t pac_exact_dp(const uint8_t* X, const uint8_t* W, uint64_t N, unsigned int Thres, unsigned int planes, uint32_t signed_x, uint32_t signed_w,
+                            uint64_t first, unsigned int group_size) {
+    int64_t exact = 0;
+    for(uint64_t i=0; i<N; i++) {
+        int64_t scale = group_size ? group_scale((first + i) / group_size) : 1; // weight scale of the element's group
         uint8_t x = X[i], w = W[i];
-        for(int p = Thres; p < P_BITS; p++) {
+        for(int p = Thres; p < (int)planes; p++) {
             uint8_t bit_x = (x >> p) & 1;
             if(!bit_x) continue;
-            for(int q = Thres; q < Q_BITS; q++) {
+            for(int q = Thres; q < (int)planes; q++) {
                 uint8_t bit_w = (w >> q) & 1;
-                exact += (bit_x & bit_w) << (p+q);
+                int64_t product = ((int64_t)(bit_x & bit_w) << (p+q)) * scale;
+                exact += (MSB_NEGATED(p, signed_x, planes) ^ MSB_NEGATED(q, signed_w, planes)) ? -product : product;
             }
         }
     }
-    // approximate computing part
-    uint64_t approx = 0;
-    for(int p=0;p<P_BITS;p++) {
-        for(int q=0;q<Q_BITS;q++) {
+    return exact;
+}
+
+// approximate computing part
+static int64_t pac_approx_dp(const uint64_t Sx[P_BITS], const uint64_t Sw[Q_BITS], uint64_t N, unsigned int Thres, unsigned int planes, uint32_t signed_x, uint32_t signed_w,
+                             uint64_t scale_sum) {
+    int64_t approx = 0;
+    for(int p=0;p<(int)planes;p++) {
+        for(int q=0;q<(int)planes;q++) {
             if(!(p >= (int)Thres && q >=(int)Thres)) {
-                uint64_t term = (uint64_t) Sx[p] * Sw[q] / N;
-                approx += term << (p+q);
+                int64_t term = (int64_t)(mul_div_u64(Sx[p], Sw[q], N) << (p+q));
+                approx += (MSB_NEGATED(p, signed_x, planes) ^ MSB_NEGATED(q, signed_w, planes)) ? -term : term;
             }
         }
     }
+    // the weight scales enter through their mean, scale_sum is the element count without scales
+    return mul_div_i64(approx, scale_sum, N);
+}
 
-    *res = exact + approx;
+// Estimate and error bound of the exact plane pairs below level (p + q < level), which the passes of a
+// progressive run (-r) have not computed yet. A pair (p, q) has between max(0, Sx + Sw - N) and min(Sx, Sw)
+// products, and its PAC estimate Sx * Sw / N lies in between, so it is off by at most the width of that range
+static int64_t refine_rest(const uint64_t Sx[P_BITS], const uint64_t Sw[Q_BITS], uint64_t N, unsigned int Thres, unsigned int planes,
+                           uint32_t signed_x, uint32_t signed_w, unsigned int level, uint64_t *bound) {
+    int64_t rest = 0;
+    *bound = 0;
+    for(int p = Thres; p < (int)planes; p++) {
+        for(int q = Thres; q < (int)planes; q++) {
+            if(p + q >= (int)level)
+                continue;
+            uint64_t hi = Sx[p] < Sw[q] ? Sx[p] : Sw[q];
+            uint64_t lo = Sx[p] + Sw[q] > N ? Sx[p] + Sw[q] - N : 0;
+            int64_t term = (int64_t)(mul_div_u64(Sx[p], Sw[q], N) << (p+q));
+            rest += (MSB_NEGATED(p, signed_x, planes) ^ MSB_NEGATED(q, signed_w, planes)) ? -term : term;
+            *bound += (hi - lo) << (p+q);
+        }
+    }
+    return rest;
+}
+
+// |res - exact| relative to |exact|, absolute if the exact result is 0
+static double rel_error(int64_t res, int64_t exact) {
+    double err = res > exact ? (double)res - (double)exact : (double)exact - (double)res;
+    return exact ? err / (exact > 0 ? (double)exact : -(double)exact) : err;
 }
 
 
@@ -118,121 +162,446 @@ int main(int argc, char **argv) {
     DPU_ASSERT(dpu_alloc(NR_DPUS, NULL, &dpu_set));
     DPU_ASSERT(dpu_get_nr_dpus(dpu_set, &nr_of_dpus)); // Number of DPUs in the DPU set
     printf("Allocated %d DPU(s)\t", nr_of_dpus);
-    printf("NR_TASKLETS\t%d\tBLOCK\t%d\n", NR_TASKLETS, BLOCK);
+    printf("NR_TASKLETS\t%d\tBLOCK\t%d\tkernel\t%u\n", NR_TASKLETS, BLOCK, p.kernel);
 
     // Load binary
     DPU_ASSERT(dpu_load(dpu_set, DPU_BINARY, NULL));
 
+    // Pre-sharded input tensors are mapped, their sharding replaces -i and -s
+    tensor_file_t input_file, output_file;
+    if(p.input_file) {
+        if(tensor_file_open(&input_file, p.input_file) != 0)
+            exit(-1);
+        if(input_file.header.nr_dpus != nr_of_dpus) {
+            fprintf(stderr, "%s is sharded for %u DPUs, %u are allocated\n", p.input_file, input_file.header.nr_dpus, nr_of_dpus);
+            exit(-1);
+        }
+        p.input_size = input_file.header.nr_elements;
+        p.wave_size = input_file.header.wave_size_dpu;
+        p.signed_x = input_file.header.signed_x;
+        p.signed_w = input_file.header.signed_w;
+        p.zero_point_x = input_file.header.zero_point_x;
+        p.zero_point_w = input_file.header.zero_point_w;
+        p.bits = input_file.header.bits ? input_file.header.bits : 8;
+        p.group_size = input_file.header.group_size;
+    }
+
+    // Input generator, unless the tensors come from a file
+    generator_t gen = {0};
+    if(!p.input_file && generator_init(&gen, p.generator, p.gen_param, p.dump_x, p.dump_w) != 0)
+        exit(-1);
+    generator_set_format(&gen, p.bits, p.signed_x, p.signed_w);
+    // Device generation: the DPUs generate the operands, the host the same ones for its reference
+    const bool device = p.device_seed >= 0;
+    if(device && p.input_file) {
+        fprintf(stderr, "Device generation replaces the input file\n");
+        exit(-1);
+    }
+    if(device && generator_set_device(&gen, p.device_seed, p.input_size) != 0)
+        exit(-1);
+
     // Input size 
-    const unsigned int input_size = p.input_size; // Total input size 
-    const unsigned int input_size_8bytes = 
-        ((input_size * sizeof(uint8_t)) % 8) != 0 ? roundup(input_size, 8) : input_size; // Total input size, 8-byte aligned
-    const unsigned int input_size_dpu = divceil(input_size, nr_of_dpus); // Input size per DPU (max.)
+    const uint64_t input_size = p.input_size; // Total input size 
+    // Specialized kernels are unrolled for one element width and threshold, the generic one takes the threshold
+    const kernel_spec_t kernel_specs[nr_kernels] = KERNEL_SPECS;
+    const kernel_spec_t kernel_spec = kernel_specs[p.kernel];
+    if(kernel_spec.bits && kernel_spec.bits != p.bits) {
+        fprintf(stderr, "Kernel %u is specialized for %u-bit elements\n", p.kernel, kernel_spec.bits);
+        exit(-1);
+    }
+    const unsigned int planes = kernel_spec.bits ? kernel_spec.bits : P_BITS; // Bit planes the kernel processes
+    const unsigned int threshold = p.threshold >= 0 ? (unsigned int)p.threshold :
+        (kernel_spec.bits ? kernel_spec.threshold : p.bits / 2); // we do the upper half of the bits (4 of 8) precisely
+    if(kernel_spec.bits && threshold != kernel_spec.threshold) {
+        fprintf(stderr, "Kernel %u is specialized for threshold %u\n", p.kernel, kernel_spec.threshold);
+        exit(-1);
+    }
+    if(threshold > planes) {
+        fprintf(stderr, "Threshold %u exceeds the %u bit planes\n", threshold, planes);
+        exit(-1);
+    }
+    // The sparse kernels take their operands compressed on the host (support/sparse.h)
+    const bool sparse = kernel_spec.format != SPARSE_NONE;
+    if(sparse && device) {
+        fprintf(stderr, "Kernel %u takes operands compressed on the host\n", p.kernel);
+        exit(-1);
+    }
+    if(sparse && p.group_size) {
+        fprintf(stderr, "Kernel %u has no weight scales\n", p.kernel);
+        exit(-1);
+    }
+    if(sparse && sparse_segment_bytes(kernel_spec.format, SPARSE_SEGMENT) > BLOCK_SIZE) {
+        fprintf(stderr, "The segments of kernel %u do not fit blocks of %u bytes\n", p.kernel, BLOCK_SIZE);
+        exit(-1);
+    }
+    // Input size per DPU and wave (max.), 8-byte aligned. Inputs larger than the MRAM are streamed in waves
+    const unsigned int max_wave_size = sparse ? sparse_max_wave_size_dpu(kernel_spec.format) : max_wave_size_dpu(p.bits, p.group_size);
+    unsigned int wave_size_dpu = p.wave_size;
+    if(wave_size_dpu == 0) {
+        uint64_t input_size_dpu = divceil(input_size, nr_of_dpus);
+        wave_size_dpu = input_size_dpu > max_wave_size ? max_wave_size : (unsigned int)input_size_dpu;
+    } else if(wave_size_dpu > max_wave_size) {
+        fprintf(stderr, "Waves of kernel %u hold at most %u elements per DPU\n", p.kernel, max_wave_size);
+        exit(-1);
+    }
+    // Packed slices stay 8-byte aligned and hold whole scale groups
+    const unsigned int align = packed_alignment(p.bits, p.group_size);
+    if(p.input_file && wave_size_dpu % align) {
+        fprintf(stderr, "%s has waves of %u elements per DPU, not a multiple of %u\n", p.input_file, wave_size_dpu, align);
+        exit(-1);
+    }
     const unsigned int input_size_dpu_8bytes = 
-        ((input_size_dpu * sizeof(uint8_t)) % 8) != 0 ? roundup(input_size_dpu, 8) : input_size_dpu; // Input size per DPU (max.), 8-byte aligned
+        (wave_size_dpu % align) != 0 ? roundup(wave_size_dpu, align) : wave_size_dpu; // Input size per DPU (max.), aligned
+    const unsigned int transfer_size_dpu = sparse ? sparse_capacity(kernel_spec.format, input_size_dpu_8bytes) :
+        PACKED_BYTES(input_size_dpu_8bytes, p.bits); // Bytes per operand in MRAM
+    const unsigned int scales_size_dpu = p.group_size ? (input_size_dpu_8bytes / p.group_size + 7) & ~7 : 0; // Bytes of weight scales in MRAM
+    const uint64_t wave_size = (uint64_t)input_size_dpu_8bytes * nr_of_dpus; // Elements per wave over all DPUs
+    const unsigned int nr_waves = divceil(input_size, wave_size);
+    const bool streaming = nr_waves > 1;
+    // Progressive passes (-r) refine one dense wave, without weight scales
+    const bool refine = p.refine >= 0;
+    if(refine && (sparse || streaming || p.group_size || threshold >= planes || p.verify.mode == VERIFY_SAMPLED)) {
+        fprintf(stderr, "Progressive passes need a dense kernel, one wave, no weight scales, exact planes and no sampled verification\n");
+        exit(-1);
+    }
+    if(device && streaming) {
+        fprintf(stderr, "Device generation needs the input in one wave, of at most %llu elements\n", (unsigned long long)wave_size);
+        exit(-1);
+    }
+    printf("nr_elements\t%llu\tnr_waves\t%u\n", (unsigned long long)input_size, nr_waves);
+    printf("encoding\t%c%c\tzero_points\t%d,%d\tbits\t%u\tgroup_size\t%u\n", p.signed_x ? 's' : 'u', p.signed_w ? 's' : 'u',
+        p.zero_point_x, p.zero_point_w, p.bits, p.group_size);
+
+    // MRAM layout of every DPU (support/mram_layout.h), pushed once: the operands, the result and the weight scales
+    mram_layout_t layout;
+    mram_layout_init(&layout);
+    const unsigned int operand_format = sparse ? (kernel_spec.format == SPARSE_BITMAP ? FORMAT_BITMAP : FORMAT_RLE) :
+        (p.bits < 8 ? FORMAT_PACKED : FORMAT_INT8);
+    if(mram_alloc(&layout, TENSOR_X, "X", transfer_size_dpu, operand_format, p.bits) |
+       mram_alloc(&layout, TENSOR_W, "W", transfer_size_dpu, operand_format, p.bits) |
+       mram_alloc(&layout, TENSOR_RESULT, "result", sizeof(int64_t), FORMAT_INT64, 64) |
+       mram_alloc(&layout, TENSOR_SCALES, "scales", scales_size_dpu, FORMAT_SCALE8, 8)) {
+        fprintf(stderr, "The tensors of a DPU do not fit in MRAM\n");
+        exit(-1);
+    }
+    mram_layout_print(&layout);
+    DPU_ASSERT(dpu_broadcast_to(dpu_set, "MRAM_LAYOUT", 0, &layout, sizeof(layout), DPU_XFER_DEFAULT));
 
     // Input/output allocation in host main memory
-    X = malloc(input_size_dpu_8bytes * nr_of_dpus * sizeof(uint8_t));
-    Y = malloc(input_size_dpu_8bytes * nr_of_dpus * sizeof(uint8_t));
-    Y_host = malloc(sizeof(uint64_t));
+    // A streamed input is generated wave by wave into two buffers: one is being filled while the other is transferred
+    if(!p.input_file) {
+        X = malloc(wave_size * (streaming ? 2 : 1) * sizeof(uint8_t));
+        Y = malloc(wave_size * (streaming ? 2 : 1) * sizeof(uint8_t));
+    }
+    // Packed or compressed operands and weight scales as pushed to the DPUs, double-buffered like the inputs
+    uint8_t *packed_X = NULL, *packed_Y = NULL, *scales = NULL;
+    if(p.bits < 8 || sparse) {
+        packed_X = malloc((uint64_t)transfer_size_dpu * nr_of_dpus * (streaming ? 2 : 1));
+        packed_Y = malloc((uint64_t)transfer_size_dpu * nr_of_dpus * (streaming ? 2 : 1));
+    }
+    if(p.group_size)
+        scales = malloc((uint64_t)scales_size_dpu * nr_of_dpus * (streaming ? 2 : 1));
+    Y_host = malloc(sizeof(int64_t));
+    if(p.output_file && tensor_file_create(&output_file, p.output_file, input_size, nr_of_dpus, nr_waves, input_size_dpu_8bytes) != 0)
+        exit(-1);
+    if(p.output_file) {
+        output_file.header.signed_x = p.signed_x;
+        output_file.header.signed_w = p.signed_w;
+        output_file.header.zero_point_x = p.zero_point_x;
+        output_file.header.zero_point_w = p.zero_point_w;
+        output_file.header.bits = p.bits;
+        output_file.header.group_size = p.group_size;
+    }
 
-    uint8_t *bufferX = X;
-    uint8_t *bufferY = Y;
+    // Transfers and launches are asynchronous when streaming and run in order per rank (support/stream.h), so the
+    // uploads of the next wave overlap the compute of the current one on other ranks, and the host generates and
+    // verifies the next wave meanwhile
+    const dpu_xfer_flags_t xfer_flags = streaming ? DPU_XFER_ASYNC : DPU_XFER_DEFAULT;
+    const dpu_launch_policy_t launch_policy = streaming ? DPU_ASYNCHRONOUS : DPU_SYNCHRONOUS;
     
     unsigned int i = 0;
 
     // Create an input file with arbitrary data
-    read_input(X, Y, input_size);
-    memset(Y_host, 0, sizeof(uint64_t));
-    uint64_t *partial_res = aligned_alloc(8, nr_of_dpus*sizeof(uint64_t));
-    memset(partial_res,0,nr_of_dpus * sizeof(uint64_t));
-
-    // first collect the Sx and Sw
-    uint32_t Sx[P_BITS] = {0}, Sw[Q_BITS] = {0};
-    for(unsigned i = 0; i < input_size; i++){
-        uint8_t x = X[i], w = Y[i];
-        for(int p=0; p<P_BITS; p++) Sx[p] += (x>>p)&1;
-        for(int q=0; q<Q_BITS; q++) Sw[q] += (w>>q)&1;
+    // Statistics of the approximation; the sparse kernels only see the pairs of non-zero elements, whose
+    // statistics are collected from the slices on the first repetition
+    uint64_t Sx[P_BITS] = {0}, Sw[Q_BITS] = {0};
+    uint64_t nonzero_pairs = 0;
+    if(p.input_file) {
+        // the statistics are precomputed in the file
+        if(!sparse) {
+            memcpy(Sx, input_file.header.Sx, sizeof(Sx));
+            memcpy(Sw, input_file.header.Sw, sizeof(Sw));
+        }
+    } else if(!streaming) {
+        generator_reset(&gen);
+        generate_input(&gen, X, Y, input_size);
+        memset(X + input_size, 0, wave_size - input_size);
+        memset(Y + input_size, 0, wave_size - input_size);
+        // first collect the Sx and Sw
+        if(!sparse)
+            bit_stats(X, Y, input_size, Sx, Sw);
     }
+    memset(Y_host, 0, sizeof(int64_t));
+    int64_t *partial_res = aligned_alloc(8, nr_of_dpus*sizeof(int64_t));
+    memset(partial_res,0,nr_of_dpus * sizeof(int64_t));
+    // Reference result of every verified DPU, DPU 0 also adds the approximate part and the correction
+    int64_t *dpu_ref = malloc(nr_of_dpus * sizeof(int64_t));
+    verify_init(&p.verify, nr_of_dpus);
+    // Weight scales of the approximated elements, their mean scales the approximate part
+    uint64_t approx_elements = input_size;
+    uint64_t scale_sum = p.group_size ? group_scale_sum(0, input_size, p.group_size) : input_size;
+    uint64_t operand_bytes = 0; // Pushed to the DPUs per repetition
+
+    int64_t exact_res = 0;
+    int64_t refine_rest_res = 0; // Estimate of the levels the progressive passes left out
+    uint64_t refine_bound = 0; // and its error bound
+    // Arguments and pushed pointers of the waves, double-buffered
+    dpu_arguments_t wave_arguments[2][NR_DPUS];
+    uint8_t *wave_xfer_X[2][NR_DPUS], *wave_xfer_Y[2][NR_DPUS], *wave_xfer_scales[2][NR_DPUS]; // What is pushed: the slices, or their packed or compressed copies
+    // Completion of the pushes from the two sets of host buffers when streaming
+    stream_fence_t pushed[2];
+    stream_fence_init(&pushed[0]);
+    stream_fence_init(&pushed[1]);
+    uint32_t nr_ranks;
+    DPU_ASSERT(dpu_get_nr_ranks(dpu_set, &nr_ranks));
 
     // Loop over main kernel
     for(int rep = 0; rep < p.n_warmup + p.n_reps; rep++) {
 
-        // Compute output on CPU (verification purposes)
-        if(rep >= p.n_warmup)
-            start(&timer, 0, rep - p.n_warmup);
-        pac_bitwise_dp(X, Y, input_size, 4, Y_host);  // we do 4 bit precision
-        if(rep >= p.n_warmup)
-            stop(&timer, 0);
-
-        printf("Load input data\n");
-        // Input arguments
-        unsigned int kernel = 0;
-        dpu_arguments_t input_arguments[NR_DPUS];
-        for(i=0; i<nr_of_dpus-1; i++) {
-            input_arguments[i].size=input_size_dpu_8bytes * sizeof(uint8_t); 
-            input_arguments[i].transfer_size=input_size_dpu_8bytes * sizeof(uint8_t); 
-            input_arguments[i].kernel=kernel;
-            input_arguments[i].threshold = 4;
-            input_arguments[i].total_elements = input_size;
-            memcpy(input_arguments[i].Sx, Sx, sizeof(Sx));
-            memcpy(input_arguments[i].Sw, Sw, sizeof(Sw));
-            input_arguments[i].dpu_rank = i;
-        }
-        input_arguments[nr_of_dpus-1].size=(input_size_8bytes - input_size_dpu_8bytes * (NR_DPUS-1)) * sizeof(uint8_t); 
-        input_arguments[nr_of_dpus-1].transfer_size=input_size_dpu_8bytes * sizeof(uint8_t); 
-        input_arguments[nr_of_dpus-1].kernel=kernel;
-        input_arguments[nr_of_dpus-1].threshold = 4;
-        input_arguments[nr_of_dpus-1].total_elements = input_size;
-        memcpy(input_arguments[nr_of_dpus-1].Sx, Sx, sizeof(Sx));
-        memcpy(input_arguments[nr_of_dpus-1].Sw, Sw, sizeof(Sw));
-        input_arguments[nr_of_dpus - 1].dpu_rank = nr_of_dpus-1;
-
-        if(rep >= p.n_warmup)
-            start(&timer, 1, rep - p.n_warmup); // Start timer (CPU-DPU transfers)
-        i = 0;
+        if(streaming && !p.input_file)
+            generator_reset(&gen);
+        memset(dpu_ref, 0, nr_of_dpus * sizeof(int64_t));
         res = 0;
-		// Copy input arguments
-        // Parallel transfers
-        DPU_FOREACH(dpu_set, dpu, i) {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, &input_arguments[i]));
-        }
-        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(input_arguments[0]), DPU_XFER_DEFAULT));
 
-        // Copy input arrays
+        for(unsigned int wave = 0; wave < nr_waves; wave++) {
+            const uint64_t wave_offset = wave * wave_size;
+            const uint64_t wave_elements = (input_size - wave_offset) < wave_size ? (input_size - wave_offset) : wave_size;
+            // The host buffers of wave - 2 are refilled once every rank has pushed them
+            if(streaming && wave >= 2) {
+                if(rep >= p.n_warmup)
+                    start(&timer, 5, rep - p.n_warmup + wave);
+                stream_fence_wait(&pushed[wave & 1], nr_ranks);
+                if(rep >= p.n_warmup)
+                    stop(&timer, 5);
+            }
+            // Host buffer of the wave, none with a tensor file, whose slices are mapped
+            uint8_t *bufferX = p.input_file ? NULL : X + (wave & 1) * (streaming ? wave_size : 0);
+            uint8_t *bufferY = p.input_file ? NULL : Y + (wave & 1) * (streaming ? wave_size : 0);
+
+            if(streaming && !p.input_file) {
+                // Generate the next wave while the DPUs are busy with the previous one
+                generate_input(&gen, bufferX, bufferY, wave_elements);
+                memset(bufferX + wave_elements, 0, wave_size - wave_elements);
+                memset(bufferY + wave_elements, 0, wave_size - wave_elements);
+                // the statistics of all waves are known from the first repetition on
+                if(rep == 0 && !sparse)
+                    bit_stats(bufferX, bufferY, wave_elements, Sx, Sw);
+            }
+
+            // Zero-point correction over the whole input, from the bit statistics that are complete on the last wave
+            const int64_t correction = wave < nr_waves - 1 ? 0 :
+                zero_point_correction(p.input_file ? input_file.header.Sx : gen.Sx, p.input_file ? input_file.header.Sw : gen.Sw,
+                                      input_size, p.signed_x, p.signed_w, p.zero_point_x, p.zero_point_w);
+
+            printf("Load input data\n");
+            // Input arguments
+            unsigned int kernel = p.kernel;
+            // The arguments and pointers of a wave are queued asynchronously, so they alternate between two sets like
+            // the host buffers, and the set of wave - 2 is free after its fence
+            dpu_arguments_t *input_arguments = wave_arguments[wave & 1];
+            uint8_t *dpu_X[NR_DPUS], *dpu_Y[NR_DPUS]; // Per-DPU slices, mapped straight from the tensor file if there is one
+            uint8_t **xfer_X = wave_xfer_X[wave & 1], **xfer_Y = wave_xfer_Y[wave & 1], **xfer_scales = wave_xfer_scales[wave & 1];
+            // Bytes pushed per operand, the largest compressed slice of each
+            unsigned int push_size_x = sparse ? 8 : transfer_size_dpu, push_size_y = push_size_x;
+            for(i=0; i<nr_of_dpus; i++) {
+                dpu_X[i] = p.input_file ? tensor_file_slice(&input_file, wave, i, 0) : bufferX + input_size_dpu_8bytes * i;
+                dpu_Y[i] = p.input_file ? tensor_file_slice(&input_file, wave, i, 1) : bufferY + input_size_dpu_8bytes * i;
+
+                uint64_t dpu_offset = (uint64_t)input_size_dpu_8bytes * i;
+                uint64_t wave_elements_8bytes = (wave_elements % align) != 0 ? roundup(wave_elements, align) : wave_elements;
+                unsigned int size = dpu_offset >= wave_elements_8bytes ? 0 :
+                    (wave_elements_8bytes - dpu_offset < input_size_dpu_8bytes ? wave_elements_8bytes - dpu_offset : input_size_dpu_8bytes);
+                input_arguments[i].size=size * sizeof(uint8_t); 
+                input_arguments[i].kernel=kernel;
+                input_arguments[i].threshold = threshold;
+                input_arguments[i].dpu_rank = i;
+                input_arguments[i].wave = wave;
+                input_arguments[i].signed_x = p.signed_x;
+                input_arguments[i].signed_w = p.signed_w;
+                input_arguments[i].zero_point_correction = correction;
+                input_arguments[i].bits = p.bits;
+                input_arguments[i].group_size = p.group_size;
+                input_arguments[i].generate = 0;
+                input_arguments[i].level = 0;
+                input_arguments[i].gen = gen.device_gen;
+                input_arguments[i].gen.first = wave_offset + dpu_offset;
+                xfer_X[i] = dpu_X[i];
+                xfer_Y[i] = dpu_Y[i];
+                if(p.bits < 8 || sparse) {
+                    uint64_t packed_offset = ((wave & 1) * (streaming ? nr_of_dpus : 0) + i) * (uint64_t)transfer_size_dpu;
+                    xfer_X[i] = packed_X + packed_offset;
+                    xfer_Y[i] = packed_Y + packed_offset;
+                }
+                if(sparse) {
+                    uint32_t bytes_x = sparse_encode(kernel_spec.format, dpu_X[i], size, xfer_X[i]);
+                    uint32_t bytes_y = sparse_encode(kernel_spec.format, dpu_Y[i], size, xfer_Y[i]);
+                    push_size_x = bytes_x > push_size_x ? bytes_x : push_size_x;
+                    push_size_y = bytes_y > push_size_y ? bytes_y : push_size_y;
+                    if(rep == 0)
+                        pair_bit_stats(dpu_X[i], dpu_Y[i], size, Sx, Sw, &nonzero_pairs);
+                } else if(p.bits < 8 && !device) {
+                    pack_elements(dpu_X[i], xfer_X[i], input_size_dpu_8bytes, p.bits);
+                    pack_elements(dpu_Y[i], xfer_Y[i], input_size_dpu_8bytes, p.bits);
+                }
+                if(p.group_size) {
+                    // slices hold whole groups, so the first group of a slice is its global element offset / group_size
+                    xfer_scales[i] = scales + ((wave & 1) * (streaming ? nr_of_dpus : 0) + i) * (uint64_t)scales_size_dpu;
+                    uint64_t first_group = (wave_offset + dpu_offset) / p.group_size;
+                    for(unsigned int g = 0; g < scales_size_dpu; g++)
+                        xfer_scales[i][g] = group_scale(first_group + g);
+                }
+                input_arguments[i].last_wave = wave == nr_waves - 1;
+                if(p.output_file && rep == 0)
+                    tensor_file_write_slice(&output_file, wave, i, dpu_X[i], dpu_Y[i], size);
+            }
+            // The statistics of the approximation are complete once the slices of the last wave are counted
+            if(sparse) {
+                approx_elements = nonzero_pairs ? nonzero_pairs : 1;
+                scale_sum = approx_elements;
+            }
+            for(i=0; i<nr_of_dpus; i++) {
+                input_arguments[i].scale_sum = scale_sum;
+                input_arguments[i].total_elements = approx_elements;
+                memcpy(input_arguments[i].Sx, Sx, sizeof(Sx));
+                memcpy(input_arguments[i].Sw, Sw, sizeof(Sw));
+            }
+            if(rep == 0 && !device)
+                operand_bytes += ((uint64_t)push_size_x + push_size_y) * nr_of_dpus;
+
+            // Compute output on CPU (verification purposes), for the sampled DPUs only with -v sampled
+            if(rep >= p.n_warmup)
+                start(&timer, 0, rep - p.n_warmup + wave);
+            for(i=0; i<nr_of_dpus; i++)
+                if(verify_dpu(&p.verify, i))
+                    dpu_ref[i] += pac_exact_dp(dpu_X[i], dpu_Y[i], input_arguments[i].size, threshold, planes, p.signed_x, p.signed_w,
+                                               wave_offset + (uint64_t)input_size_dpu_8bytes * i, p.group_size);
+            if(wave == nr_waves - 1 && verify_dpu(&p.verify, 0))
+                dpu_ref[0] += pac_approx_dp(Sx, Sw, approx_elements, threshold, planes, p.signed_x, p.signed_w, scale_sum) + correction;
+            if(rep >= p.n_warmup)
+                stop(&timer, 0);
+            // Exact dot product, to report the error of the approximation (untimed, first repetition, full verification)
+            if(rep == 0 && p.verify.mode == VERIFY_FULL) {
+                for(i=0; i<nr_of_dpus; i++)
+                    exact_res += pac_exact_dp(dpu_X[i], dpu_Y[i], input_arguments[i].size, 0, planes, p.signed_x, p.signed_w,
+                                              wave_offset + (uint64_t)input_size_dpu_8bytes * i, p.group_size);
+                if(wave == nr_waves - 1)
+                    exact_res += correction;
+            }
+
+            // The DPUs generate their operands once, untimed, instead of the pushes of every repetition
+            if(device && rep == 0) {
+                dpu_arguments_t generate_arguments[NR_DPUS];
+                DPU_FOREACH(dpu_set, dpu, i) {
+                    generate_arguments[i] = input_arguments[i];
+                    generate_arguments[i].generate = 1;
+                    DPU_ASSERT(dpu_prepare_xfer(dpu, &generate_arguments[i]));
+                }
+                DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(generate_arguments[0]), DPU_XFER_DEFAULT));
+                DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
+            }
+
+            // Streamed pushes overlap the kernels of other ranks, so timer 5 times both together with the fence waits
+            if(rep >= p.n_warmup)
+                start(&timer, streaming ? 5 : 1, rep - p.n_warmup + wave); // Start timer (CPU-DPU transfers)
+            i = 0;
+		    // Copy input arguments
+            // Parallel transfers
+            DPU_FOREACH(dpu_set, dpu, i) {
+                DPU_ASSERT(dpu_prepare_xfer(dpu, &input_arguments[i]));
+            }
+            DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(input_arguments[0]), xfer_flags));
+
+            // Copy input arrays
 #ifdef SERIAL // Serial transfers
 
-        //@@ INSERT SERIAL CPU-DPU TRANSFER HERE
+            //@@ INSERT SERIAL CPU-DPU TRANSFER HERE
 
 #else // Parallel transfers
 
-        //@@ INSERT PARALLEL CPU-DPU TRANSFER HERE
-        // FIRST PUSH X
-        DPU_FOREACH(dpu_set, dpu, i) {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, bufferX + input_size_dpu_8bytes * i));
-        }
-        DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,0,input_size_dpu_8bytes * sizeof(uint8_t), DPU_XFER_DEFAULT));
+            //@@ INSERT PARALLEL CPU-DPU TRANSFER HERE
+            // FIRST PUSH X, unless the DPUs generated it
+            if(!device) {
+                DPU_FOREACH(dpu_set, dpu, i) {
+                    DPU_ASSERT(dpu_prepare_xfer(dpu, xfer_X[i]));
+                }
+                DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,layout.tensors[TENSOR_X].offset,push_size_x, xfer_flags));
+
+                // then push y
+                DPU_FOREACH(dpu_set, dpu, i) {
+                    DPU_ASSERT(dpu_prepare_xfer(dpu, xfer_Y[i]));
+                }
+                DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,layout.tensors[TENSOR_W].offset, push_size_y, xfer_flags));
+            }
 
-        // then push y
-        DPU_FOREACH(dpu_set, dpu, i) {
-            DPU_ASSERT(dpu_prepare_xfer(dpu, bufferY + input_size_dpu_8bytes * i));
-        }
-        DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,input_size_dpu_8bytes*sizeof(uint8_t), input_size_dpu_8bytes * sizeof(uint8_t), DPU_XFER_DEFAULT));
+            // and the weight scales
+            if(p.group_size) {
+                DPU_FOREACH(dpu_set, dpu, i) {
+                    DPU_ASSERT(dpu_prepare_xfer(dpu, xfer_scales[i]));
+                }
+                DPU_ASSERT(dpu_push_xfer(dpu_set,DPU_XFER_TO_DPU,DPU_MRAM_HEAP_POINTER_NAME,layout.tensors[TENSOR_SCALES].offset, scales_size_dpu, xfer_flags));
+            }
 
 
 
 #endif
-        if(rep >= p.n_warmup)
-            stop(&timer, 1); // Stop timer (CPU-DPU transfers)
+            if(streaming)
+                stream_fence_queue(&pushed[wave & 1], dpu_set);
+            if(rep >= p.n_warmup && !streaming)
+                stop(&timer, 1); // Stop timer (CPU-DPU transfers)
 		
-        printf("Run program on DPU(s) \n");
-        // Run DPU kernel
-        if(rep >= p.n_warmup) {
-            start(&timer, 2, rep - p.n_warmup); // Start timer (DPU kernel)
-        }
-        DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
-        if(rep >= p.n_warmup) {
-            stop(&timer, 2); // Stop timer (DPU kernel)
+            printf("Run program on DPU(s) \n");
+            // Run DPU kernel
+            if(rep >= p.n_warmup && !streaming) {
+                start(&timer, 2, rep - p.n_warmup + wave); // Start timer (DPU kernel)
+            }
+            if(refine) {
+                // One launch per level p + q of the exact plane pairs, from the top down. The passes accumulate
+                // like streamed waves, DPU 0 adds the approximate part and the correction on the first. After
+                // each pass the host estimates the remaining levels from the bit statistics and stops once
+                // their error bound is within the tolerance of the result
+                for(unsigned int level = 2 * (planes - 1); ; level--) {
+                    unsigned int pass = 2 * (planes - 1) - level;
+                    for(i=0; i<nr_of_dpus; i++) {
+                        input_arguments[i].level = level + 1;
+                        input_arguments[i].wave = pass;
+                        input_arguments[i].last_wave = pass == 0;
+                    }
+                    DPU_FOREACH(dpu_set, dpu, i) {
+                        DPU_ASSERT(dpu_prepare_xfer(dpu, &input_arguments[i]));
+                    }
+                    DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_TO_DPU, "DPU_INPUT_ARGUMENTS", 0, sizeof(input_arguments[0]), DPU_XFER_DEFAULT));
+                    DPU_ASSERT(dpu_launch(dpu_set, DPU_SYNCHRONOUS));
+                    DPU_FOREACH(dpu_set, dpu, i) {
+                        DPU_ASSERT(dpu_prepare_xfer(dpu, partial_res + i));
+                    }
+                    DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, layout.tensors[TENSOR_RESULT].offset, sizeof(int64_t), DPU_XFER_DEFAULT));
+                    int64_t estimate = refine_rest(Sx, Sw, approx_elements, threshold, planes, p.signed_x, p.signed_w, level, &refine_bound);
+                    refine_rest_res = estimate;
+                    for(i=0; i<nr_of_dpus; i++)
+                        estimate += partial_res[i];
+                    if(rep == 0)
+                        printf("refine\tlevel\t%u\testimate\t%lld\tbound\t%llu\n", level, (long long)estimate, (unsigned long long)refine_bound);
+                    if(level == 2 * threshold || refine_bound <= p.refine * (estimate < 0 ? -(double)estimate : (double)estimate))
+                        break;
+                }
+            } else {
+                DPU_ASSERT(dpu_launch(dpu_set, launch_policy));
+            }
+            if(streaming && wave == nr_waves - 1)
+                DPU_ASSERT(dpu_sync(dpu_set));
+            if(rep >= p.n_warmup) {
+                stop(&timer, streaming ? 5 : 2); // Stop timer (DPU kernel)
+            }
         }
 
 #if PRINT
@@ -263,15 +632,20 @@ int main(int argc, char **argv) {
         DPU_FOREACH(dpu_set, dpu, i) {
             DPU_ASSERT(dpu_prepare_xfer(dpu, partial_res + i));
         }
-        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, input_size_dpu_8bytes * sizeof(uint8_t) + input_size_dpu_8bytes * sizeof(uint8_t), sizeof(uint64_t), DPU_XFER_DEFAULT));
-        // final collect the res
-        for(int i=0;i<nr_of_dpus;i++) {
-            res += (uint64_t)partial_res[i];
-        }
+        DPU_ASSERT(dpu_push_xfer(dpu_set, DPU_XFER_FROM_DPU, DPU_MRAM_HEAP_POINTER_NAME, layout.tensors[TENSOR_RESULT].offset, sizeof(int64_t), DPU_XFER_DEFAULT));
 
 #endif
-        if(rep >= p.n_warmup)
+        if(rep >= p.n_warmup) {
             stop(&timer, 3); // Stop timer (DPU-CPU transfers)
+            start(&timer, 4, rep - p.n_warmup); // Start timer (host reduction)
+        }
+        // final collect the res, and the estimate of the levels an early-terminated progressive run left out
+        for(i = 0; i < nr_of_dpus; i++) {
+            res += partial_res[i];
+        }
+        res += refine_rest_res;
+        if(rep >= p.n_warmup)
+            stop(&timer, 4); // Stop timer (host reduction)
 
 #if defined(CYCLES) || defined(INSTRUCTIONS)
         dpu_results_t results[nr_of_dpus];
@@ -309,6 +683,20 @@ int main(int argc, char **argv) {
         }
 #endif
     }
+    if(p.output_file)
+        tensor_file_close(&output_file);
+    // Bit density of the input, the bit-serial kernels' cycles grow with it
+    printf("bit_density\tX\t%.4f\tW\t%.4f\n",
+        bit_density(p.input_file ? input_file.header.Sx : gen.Sx, input_size),
+        bit_density(p.input_file ? input_file.header.Sw : gen.Sw, input_size));
+    // Operand bytes moved to the DPUs, which the packed widths and the sparse formats reduce
+    printf("operand_bytes\t%llu", (unsigned long long)operand_bytes);
+    if(sparse)
+        printf("\tnon_zero_pairs\t%llu", (unsigned long long)nonzero_pairs);
+    printf("\n");
+    // Relative error of the PAC result against the exact dot product
+    if(p.verify.mode == VERIFY_FULL)
+        printf("rel_error\t%.6g\texact\t%lld\tthreshold\t%u\n", rel_error(res, exact_res), (long long)exact_res, threshold);
 #ifdef CYCLES
     printf("DPU cycles  = %g\n", cc / p.n_reps);
 #elif INSTRUCTIONS
@@ -318,25 +706,58 @@ int main(int argc, char **argv) {
     // Print timing results
     printf("CPU ");
     print(&timer, 0, p.n_reps);
-    printf("CPU-DPU ");
-    print(&timer, 1, p.n_reps);
-    printf("DPU Kernel ");
-    print(&timer, 2, p.n_reps);
+    if(streaming) {
+        printf("Streamed ");
+        print(&timer, 5, p.n_reps);
+    } else {
+        printf("CPU-DPU ");
+        print(&timer, 1, p.n_reps);
+        printf("DPU Kernel ");
+        print(&timer, 2, p.n_reps);
+    }
     printf("DPU-CPU ");
     print(&timer, 3, p.n_reps);
+    printf("Host reduction ");
+    print(&timer, 4, p.n_reps);
 
     // Check output
     bool status = true;
 
-    if ((uint64_t)res != *Y_host) {
-        status = false;
-        printf("%llu(real value) -- %llu(dp returned from core) not matching", (unsigned long long)*Y_host, (unsigned long long)res);
-    }
+    if (p.verify.mode == VERIFY_FULL) {
+        for(i = 0; i < nr_of_dpus; i++)
+            *Y_host += dpu_ref[i];
+        // an early-terminated progressive result is within its error bound of the PAC result
+        uint64_t diff = res > *Y_host ? (uint64_t)(res - *Y_host) : (uint64_t)(*Y_host - res);
+        if (diff > refine_bound) {
+            status = false;
+            printf("%lld(real value) -- %lld(dp returned from core) not matching", (long long)*Y_host, (long long)res);
+        }
 
-    else {
-        printf("%llu -- %llu matched", (unsigned long long)*Y_host,(unsigned long long)res);
+        else if (refine_bound) {
+            printf("%lld -- %lld within %llu", (long long)*Y_host, (long long)res, (unsigned long long)refine_bound);
+        }
+
+        else {
+            printf("%lld -- %lld matched", (long long)*Y_host, (long long)res);
+        }
+    } else if (p.verify.mode == VERIFY_SAMPLED) {
+        // every sampled DPU against its own reference
+        unsigned int checked = 0;
+        for(i = 0; i < nr_of_dpus; i++) {
+            if(!verify_dpu(&p.verify, i))
+                continue;
+            checked++;
+            if (partial_res[i] != dpu_ref[i]) {
+                status = false;
+                printf("DPU %u: %lld(real value) -- %lld(dp returned from core) not matching\n", i, (long long)dpu_ref[i], (long long)partial_res[i]);
+            }
+        }
+        if (status)
+            printf("%u sampled DPU(s) matched", checked);
     }
-    if (status) {
+    if (p.verify.mode == VERIFY_OFF) {
+        printf("[" ANSI_COLOR_YELLOW "SKIPPED" ANSI_COLOR_RESET "] Outputs not verified\n");
+    } else if (status) {
         printf("[" ANSI_COLOR_GREEN "OK" ANSI_COLOR_RESET "] Outputs are equal\n");
     } else {
         printf("[" ANSI_COLOR_RED "ERROR" ANSI_COLOR_RESET "] Outputs differ!\n");
@@ -346,6 +767,13 @@ int main(int argc, char **argv) {
     free(X);
     free(Y);
     free(Y_host);
+    free(dpu_ref);
+    free(packed_X);
+    free(packed_Y);
+    free(scales);
+    if(p.input_file)
+        tensor_file_close(&input_file);
+    generator_close(&gen);
     DPU_ASSERT(dpu_free(dpu_set)); // Deallocate DPUs
 	
     return status ? 0 : -1;
@@ -2,12 +2,32 @@
 #define _PARAMS_H_
 
 #include "common.h"
+#include "packing.h"
+#include "verify.h"
 
 typedef struct Params {
-    unsigned int   input_size;
+    uint64_t       input_size;
+    unsigned int   wave_size;
+    char*          input_file;
+    char*          output_file;
+    char*          generator;
+    double         gen_param;
+    char*          dump_x;
+    char*          dump_w;
+    int            device_seed;
+    unsigned int   kernel;
+    unsigned int   signed_x;
+    unsigned int   signed_w;
+    int            zero_point_x;
+    int            zero_point_w;
+    unsigned int   bits;
+    unsigned int   group_size;
+    int            threshold;
+    double         refine;
     T     alpha;
     int   n_warmup;
     int   n_reps;
+    verify_t verify;
 }Params;
 
 static void usage() {
@@ -18,9 +38,25 @@ static void usage() {
         "\n    -h        help"
         "\n    -w <W>    # of untimed warmup iterations (default=0)"
         "\n    -e <E>    # of timed repetition iterations (default=1)"
+        "\n    -v <V>    verification: full, sampled[:N] (the slices of N DPUs, default=4) or off (default=full)"
         "\n"
         "\nWorkload-specific options:"
         "\n    -i <I>    input size (default=2621440 elements)"
+        "\n    -s <S>    stream wave size per DPU (default=0 elements: whole input, split into MRAM-sized waves if needed)"
+        "\n    -f <F>    read pre-sharded input tensors from file F (replaces -i and -s)"
+        "\n    -o <O>    write the input tensors to file O, sharded for this run"
+        "\n    -g <G>    input generator: binary, uniform, relu, gaussian or dump (default=binary)"
+        "\n    -p <P>    generator parameter: zero fraction for relu (default=0.5), standard deviation for gaussian (default=32)"
+        "\n    -x <X>    raw 8-bit activation dump for the dump generator"
+        "\n    -y <Y>    raw 8-bit weight dump for the dump generator"
+        "\n    -d <D>    generate the operands on the DPUs with seed D instead of pushing them (default=-1: on the host)"
+        "\n    -k <K>    DPU kernel, index into the kernel table of support/common.h (default=0)"
+        "\n    -q <Q>    operand encoding of activations and weights, u (unsigned) or s (two's complement) each (default=uu)"
+        "\n    -z <Z>    zero-points of activations and weights, ZX,ZW (default=0,0)"
+        "\n    -b <B>    element width in bits, 8, or 4/2 packed in transfers and MRAM (default=8)"
+        "\n    -c <C>    elements per 8-bit weight scale, a power of two, 0 for none (default=0)"
+        "\n    -t <T>    threshold, bit planes below are approximated (default=-1: half the element width, or the kernel's)"
+        "\n    -r <R>    progressive passes from the top exact plane pairs down, until the error bound is within R of the result (0: all; default=-1: off)"
         "\n    -a <A>    alpha (default=100)"
         "\n");
 }
@@ -28,21 +64,75 @@ static void usage() {
 struct Params input_params(int argc, char **argv) {
     struct Params p;
     p.input_size    = 2621440;
+    p.wave_size     = 0;
+    p.input_file    = NULL;
+    p.output_file   = NULL;
+    p.generator     = "binary";
+    p.gen_param     = -1;
+    p.dump_x        = NULL;
+    p.dump_w        = NULL;
+    p.device_seed   = -1;
+    p.kernel        = 0;
+    p.signed_x      = 0;
+    p.signed_w      = 0;
+    p.zero_point_x  = 0;
+    p.zero_point_w  = 0;
+    p.bits          = 8;
+    p.group_size    = 0;
+    p.threshold     = -1;
+    p.refine        = -1;
     p.alpha         = 100;
     p.n_warmup      = 0;
     p.n_reps        = 1;
+    verify_parse(&p.verify, "full");
 
     int opt;
-    while((opt = getopt(argc, argv, "hi:a:w:e:")) >= 0) {
+    while((opt = getopt(argc, argv, "hi:s:f:o:g:p:x:y:d:k:q:z:b:c:t:r:a:w:e:v:")) >= 0) {
         switch(opt) {
         case 'h':
         usage();
         exit(0);
         break;
-        case 'i': p.input_size    = atoi(optarg); break;
+        case 'i': p.input_size    = strtoull(optarg, NULL, 10); break;
+        case 's': p.wave_size     = atoi(optarg); break;
+        case 'f': p.input_file    = optarg; break;
+        case 'o': p.output_file   = optarg; break;
+        case 'g': p.generator     = optarg; break;
+        case 'p': p.gen_param     = atof(optarg); break;
+        case 'x': p.dump_x        = optarg; break;
+        case 'y': p.dump_w        = optarg; break;
+        case 'd': p.device_seed   = atoi(optarg); break;
+        case 'k': p.kernel        = atoi(optarg); break;
+        case 'q':
+            if(strlen(optarg) != 2 || !strchr("us", optarg[0]) || !strchr("us", optarg[1])) {
+                fprintf(stderr, "\nInvalid operand encoding %s!\n", optarg);
+                usage();
+                exit(0);
+            }
+            p.signed_x = optarg[0] == 's';
+            p.signed_w = optarg[1] == 's';
+            break;
+        case 'z':
+            if(sscanf(optarg, "%d,%d", &p.zero_point_x, &p.zero_point_w) != 2) {
+                fprintf(stderr, "\nInvalid zero-points %s!\n", optarg);
+                usage();
+                exit(0);
+            }
+            break;
+        case 'b': p.bits          = atoi(optarg); break;
+        case 'c': p.group_size    = atoi(optarg); break;
+        case 't': p.threshold     = atoi(optarg); break;
+        case 'r': p.refine        = atof(optarg); break;
         case 'a': p.alpha         = atoi(optarg); break;
         case 'w': p.n_warmup      = atoi(optarg); break;
         case 'e': p.n_reps        = atoi(optarg); break;
+        case 'v':
+            if(verify_parse(&p.verify, optarg)) {
+                fprintf(stderr, "\nInvalid verification mode %s!\n", optarg);
+                usage();
+                exit(0);
+            }
+            break;
         default:
             fprintf(stderr, "\nUnrecognized option!\n");
             usage();
@@ -50,6 +140,12 @@ struct Params input_params(int argc, char **argv) {
         }
     }
     assert(NR_DPUS > 0 && "Invalid # of dpus!");
+    assert(p.input_size > 0 && "Invalid input size!");
+    assert((p.bits == 8 || p.bits == 4 || p.bits == 2) && "Invalid element width!");
+    assert((p.group_size & (p.group_size - 1)) == 0 && "Scale groups must be a power of two!");
+    assert((!p.group_size || (!p.zero_point_x && !p.zero_point_w)) && "Scale groups need zero zero-points!");
+    assert(p.wave_size <= max_wave_size_dpu(p.bits, p.group_size) && "Wave does not fit in MRAM!");
+    assert(p.kernel < nr_kernels && "Invalid kernel!");
 
     return p;
 }
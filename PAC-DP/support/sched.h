@@ -0,0 +1,91 @@
+#ifndef _SCHED_H_
+#define _SCHED_H_
+
+#include <stdint.h>
+#include <defs.h>
+
+/*
+ * Block distribution among tasklets (SCHED in the Makefile)
+ *   STATIC     : tasklet t processes blocks t, t + NR_TASKLETS, t + 2 * NR_TASKLETS, ...
+ *   DYNAMIC    : tasklets claim CHUNK consecutive blocks at a time from a shared counter,
+ *                so that tasklets with cheaper (sparser) blocks take over more of them
+ *   CONTIGUOUS : tasklet t streams the t-th of NR_TASKLETS contiguous, block-aligned chunks, so every
+ *                tasklet reads sequential MRAM addresses instead of all tasklets touching different rows
+ * Usage:
+ *   sched_init(); // tasklet 0, before the barrier that precedes the block loop
+ *   for(uint32_t byte_index = sched_first(tasklet_id, size); byte_index < size; byte_index = sched_next(tasklet_id, byte_index))
+ */
+
+#if defined(DYNAMIC) || defined(CONTIGUOUS)
+static uint32_t sched_chunk_end[NR_TASKLETS]; // End of the chunk each tasklet is working on
+#endif
+
+#ifdef DYNAMIC
+#include <mutex.h>
+
+#ifndef CHUNK
+#define CHUNK 4
+#endif
+
+MUTEX_INIT(sched_mutex);
+static uint32_t sched_counter; // Byte index of the next unclaimed block
+
+void sched_init(void) {
+    sched_counter = 0;
+}
+
+static uint32_t sched_claim(unsigned int tasklet_id) {
+    mutex_lock(sched_mutex);
+    uint32_t byte_index = sched_counter;
+    sched_counter += CHUNK << BLOCK_SIZE_LOG2;
+    mutex_unlock(sched_mutex);
+    sched_chunk_end[tasklet_id] = byte_index + (CHUNK << BLOCK_SIZE_LOG2);
+    return byte_index;
+}
+
+uint32_t sched_first(unsigned int tasklet_id, uint32_t size) {
+    (void)size;
+    return sched_claim(tasklet_id);
+}
+
+uint32_t sched_next(unsigned int tasklet_id, uint32_t byte_index) {
+    byte_index += BLOCK_SIZE;
+    return byte_index < sched_chunk_end[tasklet_id] ? byte_index : sched_claim(tasklet_id);
+}
+
+#elif defined(CONTIGUOUS)
+
+void sched_init(void) {
+}
+
+uint32_t sched_first(unsigned int tasklet_id, uint32_t size) {
+    // whole blocks per tasklet, so that no block straddles two chunks
+    uint32_t chunk = ((size + NR_TASKLETS - 1) / NR_TASKLETS + BLOCK_SIZE - 1) & ~(BLOCK_SIZE - 1);
+    uint32_t first = tasklet_id * chunk;
+    sched_chunk_end[tasklet_id] = first + chunk;
+    return first < size ? first : size;
+}
+
+uint32_t sched_next(unsigned int tasklet_id, uint32_t byte_index) {
+    byte_index += BLOCK_SIZE;
+    return byte_index < sched_chunk_end[tasklet_id] ? byte_index : UINT32_MAX; // UINT32_MAX ends the loop
+}
+
+#else
+
+void sched_init(void) {
+}
+
+uint32_t sched_first(unsigned int tasklet_id, uint32_t size) {
+    (void)size;
+    return tasklet_id << BLOCK_SIZE_LOG2;
+}
+
+uint32_t sched_next(unsigned int tasklet_id, uint32_t byte_index) {
+    (void)tasklet_id;
+    return byte_index + BLOCK_SIZE * NR_TASKLETS;
+}
+
+#endif
+
+#endif
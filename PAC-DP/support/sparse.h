@@ -0,0 +1,98 @@
+#ifndef _SPARSE_H_
+#define _SPARSE_H_
+
+#include <stdint.h>
+#include <string.h>
+
+/*
+ * Sparse operand formats of the sparse PAC kernels (-k 5: bitmap, -k 6: run-length)
+ *
+ * Each operand of a DPU slice is compressed in segments of SPARSE_SEGMENT elements, half a kernel block,
+ * so that a compressed segment never outgrows the BLOCK_SIZE WRAM cache and the tasklets still take whole
+ * blocks (two segments) in any order. The slice starts with a table of one sparse_block_t per segment,
+ * the 8-byte aligned segments follow:
+ *   bitmap : SPARSE_BITMAP_BYTES with bit i set for a non-zero element i, then the non-zero elements in order;
+ *            the bitmap takes at least 8 bytes, so its full segments only fit blocks from 16 bytes (BLOCK 4) on
+ *   rle    : one (zeros before, element) byte pair per non-zero element; a run of more than SPARSE_RUN_MAX
+ *            zeros takes a (SPARSE_RUN_MAX, 0) pair for every SPARSE_RUN_MAX + 1 elements it skips
+ * Zero elements cost a bit (bitmap) or nothing (rle) instead of a byte, so bitmaps pay off above 1/8 and
+ * run-lengths above 1/2 of zeros. Elements stay one byte each, packed widths (-b) only narrow their values.
+ * MRAM per DPU: [X table and segments][W table and segments][8-byte result], each operand at most
+ * sparse_capacity() bytes.
+ */
+
+enum sparse_formats {
+    SPARSE_NONE = 0, // Dense operands
+    SPARSE_BITMAP,
+    SPARSE_RLE,
+};
+
+typedef struct {
+    uint32_t offset; // Bytes from the start of the slice
+    uint32_t nnz; // Non-zero elements (bitmap) or byte pairs (rle)
+} sparse_block_t;
+
+#define SPARSE_SEGMENT (BLOCK_SIZE / 2) // Elements per compressed segment
+#define SPARSE_BITMAP_BYTES (((SPARSE_SEGMENT + 63) / 64) * 8) // Whole 64-bit words, at least one
+#define SPARSE_RUN_MAX 255
+
+// Bytes of a compressed segment with nnz non-zero elements or pairs
+static inline uint32_t sparse_segment_bytes(uint32_t format, uint32_t nnz) {
+    return format == SPARSE_BITMAP ? SPARSE_BITMAP_BYTES + ((nnz + 7) & ~7) : (2 * nnz + 7) & ~7;
+}
+
+// Bytes per operand in MRAM for a slice of nr_elements, with every segment at its largest
+static inline uint32_t sparse_capacity(uint32_t format, uint32_t nr_elements) {
+    uint32_t segments = (nr_elements + SPARSE_SEGMENT - 1) / SPARSE_SEGMENT;
+    return segments * (sizeof(sparse_block_t) + sparse_segment_bytes(format, SPARSE_SEGMENT));
+}
+
+// Largest per-DPU wave (elements per operand) whose compressed X and W fit in MRAM next to the result
+static inline unsigned int sparse_max_wave_size_dpu(uint32_t format) {
+    uint64_t segments = ((uint64_t)MRAM_SIZE - 8) / 2 / (sizeof(sparse_block_t) + sparse_segment_bytes(format, SPARSE_SEGMENT));
+    return (unsigned int)(segments * SPARSE_SEGMENT);
+}
+
+// Compress a slice of nr_elements into dst (sparse_capacity bytes), returns the bytes used
+uint32_t sparse_encode(uint32_t format, const uint8_t *src, uint32_t nr_elements, uint8_t *dst) {
+    uint32_t segments = (nr_elements + SPARSE_SEGMENT - 1) / SPARSE_SEGMENT;
+    sparse_block_t *table = (sparse_block_t *)dst;
+    uint32_t offset = segments * sizeof(sparse_block_t);
+    for(uint32_t s = 0; s < segments; s++) {
+        const uint8_t *segment = src + s * SPARSE_SEGMENT;
+        uint32_t n = nr_elements - s * SPARSE_SEGMENT < SPARSE_SEGMENT ? nr_elements - s * SPARSE_SEGMENT : SPARSE_SEGMENT;
+        uint8_t *out = dst + offset;
+        uint32_t nnz = 0, bytes = 0;
+        if(format == SPARSE_BITMAP) {
+            memset(out, 0, SPARSE_BITMAP_BYTES);
+            bytes = SPARSE_BITMAP_BYTES;
+            for(uint32_t i = 0; i < n; i++) {
+                if(segment[i]) {
+                    out[i / 8] |= 1 << (i % 8);
+                    out[bytes++] = segment[i];
+                    nnz++;
+                }
+            }
+        } else {
+            uint32_t zeros = 0;
+            for(uint32_t i = 0; i < n; i++) {
+                if(segment[i] || zeros == SPARSE_RUN_MAX) {
+                    out[bytes++] = (uint8_t)zeros;
+                    out[bytes++] = segment[i];
+                    nnz++;
+                    zeros = 0;
+                } else {
+                    zeros++;
+                }
+            }
+        }
+        while(bytes & 7)
+            out[bytes++] = 0;
+        table[s].offset = offset;
+        table[s].nnz = nnz;
+        offset += bytes;
+    }
+    return offset;
+}
+
+#endif
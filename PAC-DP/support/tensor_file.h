@@ -0,0 +1,242 @@
+#ifndef _TENSOR_FILE_H_
+#define _TENSOR_FILE_H_
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/*
+ * Pre-sharded tensor file
+ *
+ * An activation (X) and weight (W) pair, stored exactly as the host pushes it to the DPUs:
+ *   [header page][per-slice bit statistics, page aligned][wave 0: X slices of all DPUs, W slices of all DPUs][wave 1: ...]
+ * Every per-DPU slice starts on a page boundary and is zero-padded to slice_stride bytes,
+ * so the host maps the file and hands the slices to dpu_prepare_xfer without copying them.
+ * Element order is wave, DPU, element, i.e. the order of the generated (and streamed) inputs.
+ */
+
+#define TENSOR_FILE_MAGIC 0x31434150 // "PAC1"
+#define TENSOR_FILE_VERSION 1
+#define TENSOR_FILE_PAGE 4096
+
+enum tensor_format {
+    TENSOR_UINT8 = 0,
+};
+
+typedef struct {
+    uint32_t magic;
+    uint32_t version;
+    uint32_t format; // Element format, see tensor_format
+    uint32_t nr_dpus; // DPUs the tensors are sharded for
+    uint32_t nr_waves;
+    uint32_t wave_size_dpu; // Elements per DPU and wave, 8-byte aligned
+    uint64_t slice_stride; // Bytes between consecutive slices, page aligned
+    uint64_t nr_elements;
+    uint64_t stats_offset; // Per-slice bit statistics (tensor_slice_stats_t[nr_waves][nr_dpus])
+    uint64_t data_offset; // First slice
+    // Shapes, for reference only: the dot product runs over nr_elements
+    uint32_t ndim_x;
+    uint32_t ndim_w;
+    uint32_t shape_x[4];
+    uint32_t shape_w[4];
+    // Quantization parameters: real = scale * (q - zero_point)
+    float scale_x;
+    float scale_w;
+    int32_t zero_point_x;
+    int32_t zero_point_w;
+    // Bit statistics over all elements
+    uint64_t Sx[8];
+    uint64_t Sw[8];
+    // Two's-complement operands (files without these fields read as unsigned)
+    uint32_t signed_x;
+    uint32_t signed_w;
+    // Element width of the values (0 reads as 8) and elements per weight scale, elements are stored one per byte
+    uint32_t bits;
+    uint32_t group_size;
+} tensor_file_header_t;
+
+typedef struct {
+    uint64_t Sx[8];
+    uint64_t Sw[8];
+} tensor_slice_stats_t;
+
+typedef struct {
+    int fd;
+    FILE *out;
+    uint8_t *map;
+    size_t map_size;
+    tensor_file_header_t header;
+    tensor_slice_stats_t *stats;
+} tensor_file_t;
+
+#define tensor_file_align(n) (((n) + TENSOR_FILE_PAGE - 1) / TENSOR_FILE_PAGE * TENSOR_FILE_PAGE)
+
+uint64_t tensor_file_slice_offset(const tensor_file_header_t *h, unsigned int wave, unsigned int dpu, unsigned int operand) {
+    return h->data_offset + (((uint64_t)wave * 2 + operand) * h->nr_dpus + dpu) * h->slice_stride;
+}
+
+// Whether an element value fits an element width of bits bits: 0 to 2^bits - 1, or two's complement when signed,
+// and -1/+1 for signed 1-bit elements (support/packing.h)
+static inline int tensor_file_value_fits(uint8_t v, unsigned int bits, uint32_t is_signed) {
+    if(bits >= 8)
+        return 1;
+    if(bits == 1)
+        return is_signed ? v == 1 || v == 0xff : v <= 1;
+    if(is_signed)
+        return (int8_t)v >= -(1 << (bits - 1)) && (int8_t)v < (1 << (bits - 1));
+    return v < (1 << bits);
+}
+
+// Index of the first element of X (operand 0) or W (operand 1) that does not fit the element width of the
+// header, or nr_elements if all fit. Packing would drop the upper bits of the others
+uint64_t tensor_file_check_bits(const tensor_file_t *tf, unsigned int operand) {
+    const tensor_file_header_t *h = &tf->header;
+    unsigned int bits = h->bits ? h->bits : 8;
+    uint32_t is_signed = operand ? h->signed_w : h->signed_x;
+    if(bits >= 8)
+        return h->nr_elements;
+    for(unsigned int wave = 0; wave < h->nr_waves; wave++)
+        for(unsigned int dpu = 0; dpu < h->nr_dpus; dpu++) {
+            uint64_t first = ((uint64_t)wave * h->nr_dpus + dpu) * h->wave_size_dpu;
+            if(first >= h->nr_elements)
+                return h->nr_elements;
+            uint64_t valid = h->nr_elements - first < h->wave_size_dpu ? h->nr_elements - first : h->wave_size_dpu;
+            const uint8_t *slice = tf->map + tensor_file_slice_offset(h, wave, dpu, operand);
+            for(uint64_t i = 0; i < valid; i++)
+                if(!tensor_file_value_fits(slice[i], bits, is_signed))
+                    return first + i;
+        }
+    return h->nr_elements;
+}
+
+// Map a tensor file for reading. Returns 0 on success
+int tensor_file_open(tensor_file_t *tf, const char *path) {
+    struct stat st;
+    memset(tf, 0, sizeof(*tf));
+    tf->fd = open(path, O_RDONLY);
+    if(tf->fd < 0 || fstat(tf->fd, &st) != 0 || (size_t)st.st_size < sizeof(tensor_file_header_t)) {
+        fprintf(stderr, "Cannot open tensor file %s\n", path);
+        return -1;
+    }
+    tf->map_size = st.st_size;
+    tf->map = mmap(NULL, tf->map_size, PROT_READ, MAP_SHARED, tf->fd, 0);
+    if(tf->map == MAP_FAILED) {
+        fprintf(stderr, "Cannot map tensor file %s\n", path);
+        close(tf->fd);
+        return -1;
+    }
+    memcpy(&tf->header, tf->map, sizeof(tf->header));
+    const tensor_file_header_t *h = &tf->header;
+    // The slices must hold the elements of every wave, 8-byte aligned, and lie behind the statistics in the file
+    if(h->magic != TENSOR_FILE_MAGIC || h->version != TENSOR_FILE_VERSION || h->nr_dpus == 0 ||
+       h->wave_size_dpu == 0 || h->wave_size_dpu % 8 || h->slice_stride < h->wave_size_dpu ||
+       (uint64_t)h->nr_waves * h->nr_dpus * h->wave_size_dpu < h->nr_elements ||
+       h->stats_offset + (uint64_t)h->nr_waves * h->nr_dpus * sizeof(tensor_slice_stats_t) > h->data_offset ||
+       tensor_file_slice_offset(h, h->nr_waves, 0, 0) > tf->map_size) {
+        fprintf(stderr, "Invalid tensor file %s\n", path);
+        munmap(tf->map, tf->map_size);
+        close(tf->fd);
+        return -1;
+    }
+    tf->stats = (tensor_slice_stats_t *)(tf->map + h->stats_offset);
+    // Elements wider than the element width would be truncated by packing but not by the references
+    for(unsigned int operand = 0; operand < 2; operand++) {
+        uint64_t bad = tensor_file_check_bits(tf, operand);
+        if(bad < h->nr_elements) {
+            fprintf(stderr, "Element %llu of %c in tensor file %s does not fit in %u bits\n", (unsigned long long)bad,
+                    operand ? 'W' : 'X', path, h->bits);
+            munmap(tf->map, tf->map_size);
+            close(tf->fd);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+// Slice of X (operand 0) or W (operand 1) for one DPU and wave, ready for dpu_prepare_xfer
+uint8_t *tensor_file_slice(const tensor_file_t *tf, unsigned int wave, unsigned int dpu, unsigned int operand) {
+    return tf->map + tensor_file_slice_offset(&tf->header, wave, dpu, operand);
+}
+
+// Start writing a tensor file with the given sharding. Slices are added with tensor_file_write_slice
+int tensor_file_create(tensor_file_t *tf, const char *path, uint64_t nr_elements, unsigned int nr_dpus,
+                      unsigned int nr_waves, unsigned int wave_size_dpu) {
+    memset(tf, 0, sizeof(*tf));
+    tf->fd = -1;
+    tf->out = fopen(path, "w+b");
+    if(!tf->out) {
+        fprintf(stderr, "Cannot create tensor file %s\n", path);
+        return -1;
+    }
+    tensor_file_header_t *h = &tf->header;
+    h->magic = TENSOR_FILE_MAGIC;
+    h->version = TENSOR_FILE_VERSION;
+    h->format = TENSOR_UINT8;
+    h->nr_dpus = nr_dpus;
+    h->nr_waves = nr_waves;
+    h->wave_size_dpu = wave_size_dpu;
+    h->slice_stride = tensor_file_align((uint64_t)wave_size_dpu);
+    h->nr_elements = nr_elements;
+    h->stats_offset = TENSOR_FILE_PAGE;
+    h->data_offset = tensor_file_align(h->stats_offset + (uint64_t)nr_waves * nr_dpus * sizeof(tensor_slice_stats_t));
+    h->ndim_x = h->ndim_w = 1;
+    h->shape_x[0] = h->shape_w[0] = (uint32_t)nr_elements;
+    h->scale_x = h->scale_w = 1.0f;
+    tf->stats = calloc((size_t)nr_waves * nr_dpus, sizeof(tensor_slice_stats_t));
+    if(!tf->stats) {
+        fprintf(stderr, "Cannot allocate the statistics of tensor file %s\n", path);
+        fclose(tf->out);
+        tf->out = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+// Store the X and W slices of one DPU and wave (size valid bytes, the rest of the slice stays zero)
+void tensor_file_write_slice(tensor_file_t *tf, unsigned int wave, unsigned int dpu,
+                             const uint8_t *x, const uint8_t *w, unsigned int size) {
+    tensor_file_header_t *h = &tf->header;
+    tensor_slice_stats_t *s = &tf->stats[(uint64_t)wave * h->nr_dpus + dpu];
+    for(unsigned int i = 0; i < size; i++) {
+        for(int b = 0; b < 8; b++) {
+            s->Sx[b] += (x[i] >> b) & 1;
+            s->Sw[b] += (w[i] >> b) & 1;
+        }
+    }
+    for(int b = 0; b < 8; b++) {
+        h->Sx[b] += s->Sx[b];
+        h->Sw[b] += s->Sw[b];
+    }
+    fseek(tf->out, tensor_file_slice_offset(h, wave, dpu, 0), SEEK_SET);
+    fwrite(x, 1, size, tf->out);
+    fseek(tf->out, tensor_file_slice_offset(h, wave, dpu, 1), SEEK_SET);
+    fwrite(w, 1, size, tf->out);
+}
+
+void tensor_file_close(tensor_file_t *tf) {
+    if(tf->out) {
+        tensor_file_header_t *h = &tf->header;
+        uint8_t page[TENSOR_FILE_PAGE] = {0};
+        memcpy(page, h, sizeof(*h));
+        // Extend the file to its full size so that the last slices are zero-padded too
+        fseek(tf->out, tensor_file_slice_offset(h, h->nr_waves, 0, 0) - 1, SEEK_SET);
+        fputc(0, tf->out);
+        fseek(tf->out, 0, SEEK_SET);
+        fwrite(page, 1, sizeof(page), tf->out);
+        fseek(tf->out, h->stats_offset, SEEK_SET);
+        fwrite(tf->stats, sizeof(tensor_slice_stats_t), (size_t)h->nr_waves * h->nr_dpus, tf->out);
+        fclose(tf->out);
+        free(tf->stats);
+    } else if(tf->map) {
+        munmap(tf->map, tf->map_size);
+        close(tf->fd);
+    }
+    memset(tf, 0, sizeof(*tf));
+}
+
+#endif
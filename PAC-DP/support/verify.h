@@ -0,0 +1,70 @@
+#ifndef _VERIFY_H_
+#define _VERIFY_H_
+
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+/*
+ * Verification of the DPU results (-v)
+ *   full       : the CPU reference over the whole input (default)
+ *   sampled[:N]: the reference over the slices of N DPUs only (default VERIFY_SAMPLES), each compared with
+ *                the result of its own DPU, so the check costs the same at any number of DPUs
+ *   off        : no reference, for long runs of known-good kernels
+ * The sampled DPUs are spread evenly over the DPU set from a random offset, drawn once per run and printed.
+ */
+
+enum verify_modes {
+    VERIFY_FULL = 0,
+    VERIFY_SAMPLED,
+    VERIFY_OFF,
+};
+
+#define VERIFY_SAMPLES 4
+
+typedef struct {
+    enum verify_modes mode;
+    unsigned int samples; // DPUs checked in sampled mode
+    unsigned int stride; // Every stride-th DPU from offset is sampled
+    unsigned int offset;
+} verify_t;
+
+// Parses full, sampled, sampled:N or off. Returns 0 on success
+int verify_parse(verify_t *v, const char *arg) {
+    v->samples = VERIFY_SAMPLES;
+    v->stride = 1;
+    v->offset = 0;
+    if(!strcmp(arg, "full"))
+        v->mode = VERIFY_FULL;
+    else if(!strcmp(arg, "off"))
+        v->mode = VERIFY_OFF;
+    else if(!strncmp(arg, "sampled", 7) && (arg[7] == '\0' || (arg[7] == ':' && atoi(arg + 8) > 0))) {
+        v->mode = VERIFY_SAMPLED;
+        if(arg[7] == ':')
+            v->samples = atoi(arg + 8);
+    } else
+        return -1;
+    return 0;
+}
+
+// Draws the sampled DPUs among nr_dpus and prints them
+void verify_init(verify_t *v, unsigned int nr_dpus) {
+    if(v->mode != VERIFY_SAMPLED)
+        return;
+    v->stride = v->samples < nr_dpus ? nr_dpus / v->samples : 1;
+    v->offset = (unsigned int)time(NULL) % v->stride;
+    printf("verify\tsampled\tdpus");
+    for(unsigned int i = v->offset, n = 0; i < nr_dpus && n < v->samples; i += v->stride, n++)
+        printf("%c%u", n ? ',' : '\t', i);
+    printf("\n");
+}
+
+// Whether the reference covers the slice of DPU i
+static inline bool verify_dpu(const verify_t *v, unsigned int i) {
+    return v->mode == VERIFY_FULL ||
+        (v->mode == VERIFY_SAMPLED && i % v->stride == v->offset && i / v->stride < v->samples);
+}
+
+#endif
@@ -0,0 +1,39 @@
+#!/bin/bash
+# Kernel cycles against input bit density, for every dot-product kernel and input generator.
+# usage: benchmarks/bit_density.sh [input size] [activation dump] [weight dump]
+# Prints one tab-separated row per run. NR_DPUS, NR_TASKLETS and BLOCK are taken from the environment.
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+ROOT="${SCRIPT_DIR}/.."
+SIZE=${1:-262144}
+DUMP_X=$2
+DUMP_W=$3
+MAKE_VARS="NR_DPUS=${NR_DPUS:-32} NR_TASKLETS=${NR_TASKLETS:-16} BLOCK=${BLOCK:-10} PERF=CYCLES"
+
+# generator and parameter (- for its default)
+WORKLOADS=(
+    "binary -"
+    "uniform -"
+    "relu 0.25" "relu 0.5" "relu 0.75" "relu 0.9"
+    "gaussian 8" "gaussian 16" "gaussian 32" "gaussian 64"
+)
+if [ -n "${DUMP_X}" ] && [ -n "${DUMP_W}" ]; then
+    WORKLOADS+=("dump -")
+fi
+
+printf "kernel\tgenerator\tparam\tdensity_x\tdensity_w\tdpu_cycles\tkernel_ms\tstatus\n"
+# benchmark directory:kernel index (-k)
+for kernel in BASELINE-DP:0 BASELINE-DP:1 BASELINE-DP:2 PAC-DP:0 PAC-AWQ-DP:0; do
+    make -s -C "${ROOT}/${kernel%:*}" ${MAKE_VARS} > /dev/null || exit 1
+    for workload in "${WORKLOADS[@]}"; do
+        set -- ${workload}
+        args=(-w 1 -e 5 -k "${kernel#*:}" -i "${SIZE}" -g "$1")
+        [ "$2" != "-" ] && args+=(-p "$2")
+        [ "$1" = "dump" ] && args+=(-x "${DUMP_X}" -y "${DUMP_W}")
+        out=$(cd "${ROOT}/${kernel%:*}" && ./bin/host_code "${args[@]}")
+        density=$(echo "${out}" | awk '/^bit_density/ { print $3 "\t" $5 }')
+        cycles=$(echo "${out}" | awk '/^DPU cycles/ { print $4 }')
+        kernel_ms=$(echo "${out}" | grep -o "DPU Kernel Time (ms): [0-9.]*" | awk '{ print $5 }')
+        status=$(echo "${out}" | grep -q "Outputs are equal" && echo OK || echo ERROR)
+        printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "${kernel}" "$1" "$2" "${density}" "${cycles}" "${kernel_ms}" "${status}"
+    done
+done
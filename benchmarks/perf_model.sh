@@ -0,0 +1,208 @@
+#!/bin/bash
+# Analytical performance model of the dot-product kernels, fitted to host runs and cycle-accurate simulator logs.
+# usage: benchmarks/perf_model.sh calibrate > calibration.tsv
+#        benchmarks/perf_model.sh fit calibration.tsv [Cycle_accurate_sim_log/*.log] > model.tsv
+#        benchmarks/perf_model.sh predict model.tsv <kernel> <elements per DPU> <density x> <density w> [tasklets] [block]
+#
+# Model, per kernel (benchmark directory:kernel index, e.g. PAC-DP:0), with n elements per DPU, bit densities
+# dx and dw, and the pipeline factor f = max(1, 11 / NR_TASKLETS) (a tasklet issues at most every 11 cycles):
+#   kernel cycles = a + f * n * (b + c * dx + d * dw)
+#   DMA cycles    = DMAs * e + bytes * g, with 2 DMAs of 2^BLOCK bytes per block    (fitted to simulator logs)
+#   CPU-DPU ms    = t0 + t1 * bytes per DPU, DPU-CPU ms = r                            (fitted to host runs)
+# calibrate runs every kernel with PERF=CYCLES over SIZES (elements per DPU) and the generators' bit densities;
+# NR_DPUS, NR_TASKLETS and BLOCK are taken from the environment and recorded, so calibrations at several
+# NR_TASKLETS/BLOCK can be concatenated. fit prints the model and its error on the calibration runs and on the
+# simulator logs (kernel from the log name, elements per DPU from read_bytes, bit density LOG_DENSITY, default 0.25).
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+ROOT="${SCRIPT_DIR}/.."
+KERNELS=(BASELINE-DP:0 BASELINE-DP:1 BASELINE-DP:2 BASELINE-DP:3 PAC-DP:0 PAC-AWQ-DP:0) # benchmark directory:kernel index (-k)
+
+# time (ms) of one timer from the host output
+timer_ms() {
+    echo "$1" | grep -o "$2 Time (ms): [0-9.]*" | awk '{ print $NF }'
+}
+
+calibrate() {
+    local dpus=${NR_DPUS:-32} tasklets=${NR_TASKLETS:-16} block=${BLOCK:-10}
+    # generator and parameter (- for its default), for a spread of bit densities
+    local workloads=("binary -" "uniform -" "relu 0.5" "relu 0.9" "gaussian 8" "gaussian 32")
+    printf "kernel\ttasklets\tblock\telements_dpu\tdensity_x\tdensity_w\tdpu_cycles\tcpu_dpu_ms\tdpu_cpu_ms\tstatus\n"
+    for kernel in "${KERNELS[@]}"; do
+        make -s -C "${ROOT}/${kernel%:*}" NR_DPUS=${dpus} NR_TASKLETS=${tasklets} BLOCK=${block} PERF=CYCLES > /dev/null || exit 1
+        for size in ${SIZES:-65536 262144 1048576}; do
+            for workload in "${workloads[@]}"; do
+                set -- ${workload}
+                args=(-w 1 -e "${REPS:-3}" -k "${kernel#*:}" -i $((size * dpus)) -g "$1")
+                [ "$2" != "-" ] && args+=(-p "$2")
+                out=$(cd "${ROOT}/${kernel%:*}" && ./bin/host_code "${args[@]}")
+                density=$(echo "${out}" | awk '/^bit_density/ { print $3 "\t" $5 }')
+                cycles=$(echo "${out}" | awk '/^DPU cycles/ { print $4 }')
+                status=$(echo "${out}" | grep -q "Outputs are equal" && echo OK || echo ERROR)
+                printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "${kernel}" "${tasklets}" "${block}" "${size}" "${density}" \
+                    "${cycles}" "$(timer_ms "${out}" "CPU-DPU")" "$(timer_ms "${out}" "DPU-CPU")" "${status}"
+            done
+        done
+    done
+}
+
+# Least squares shared by fit: normal equations A x = y of n unknowns, scaled to a unit diagonal and solved by
+# Gaussian elimination with a small ridge, so that collinear features (dx == dw for most generators) split their
+# weight instead of failing
+AWK_SOLVE='
+    function abs(v) { return v < 0 ? -v : v }
+    function solve(n,   i, j, k, r, f, t, s) {
+        for(i = 1; i <= n; i++)
+            s[i] = A[i, i] > 0 ? sqrt(A[i, i]) : 1
+        for(i = 1; i <= n; i++) {
+            for(j = 1; j <= n; j++) A[i, j] /= s[i] * s[j]
+            y[i] /= s[i]
+            A[i, i] += 1e-6
+        }
+        for(i = 1; i <= n; i++) {
+            r = i
+            for(k = i + 1; k <= n; k++)
+                if(abs(A[k, i]) > abs(A[r, i])) r = k
+            for(j = 1; j <= n; j++) { t = A[i, j]; A[i, j] = A[r, j]; A[r, j] = t }
+            t = y[i]; y[i] = y[r]; y[r] = t
+            if(A[i, i] == 0) continue
+            for(k = i + 1; k <= n; k++) {
+                f = A[k, i] / A[i, i]
+                for(j = i; j <= n; j++) A[k, j] -= f * A[i, j]
+                y[k] -= f * y[i]
+            }
+        }
+        for(i = n; i >= 1; i--) {
+            t = y[i]
+            for(j = i + 1; j <= n; j++) t -= A[i, j] * x[j]
+            x[i] = A[i, i] ? t / A[i, i] : 0
+        }
+        for(i = 1; i <= n; i++)
+            x[i] /= s[i]
+    }
+    function accumulate(n, feature, target,   i, j) {
+        for(i = 1; i <= n; i++) {
+            for(j = 1; j <= n; j++) A[i, j] += feature[i] * feature[j]
+            y[i] += feature[i] * target
+        }
+    }
+    function reset(n,   i, j) {
+        for(i = 1; i <= n; i++) { y[i] = 0; x[i] = 0; for(j = 1; j <= n; j++) A[i, j] = 0 }
+    }
+    function pipeline(tasklets) { return tasklets < 11 ? 11 / tasklets : 1 }
+'
+
+fit() {
+    local calibration=$1
+    shift
+    # kernel cycles and transfers from the calibration runs
+    awk -F '\t' "${AWK_SOLVE}"'
+        NR > 1 && $10 == "OK" && $7 != "" {
+            rows++
+            kernel[rows] = $1; f = pipeline($2); n[rows] = $4; dx[rows] = $5; dw[rows] = $6; cycles[rows] = $7
+            scale[rows] = f
+            if(!($1 in seen)) { seen[$1] = 1; order[++nr_kernels] = $1 }
+            bytes = 2 * $4 # X and W, 8-bit
+            tsum[1, 1]++; tsum[1, 2] += bytes; tsum[2, 2] += bytes * bytes; ty[1] += $8; ty[2] += bytes * $8
+            rsum += $9
+        }
+        END {
+            printf "# kernel\ta\tb\tc\td\tmean_abs_error\n"
+            for(k = 1; k <= nr_kernels; k++) {
+                reset(4)
+                for(r = 1; r <= rows; r++) {
+                    if(kernel[r] != order[k]) continue
+                    feature[1] = 1; feature[2] = scale[r] * n[r]; feature[3] = feature[2] * dx[r]; feature[4] = feature[2] * dw[r]
+                    accumulate(4, feature, cycles[r])
+                }
+                solve(4)
+                error = 0; count = 0
+                for(r = 1; r <= rows; r++) {
+                    if(kernel[r] != order[k]) continue
+                    predicted = x[1] + scale[r] * n[r] * (x[2] + x[3] * dx[r] + x[4] * dw[r])
+                    error += abs(predicted - cycles[r]) / cycles[r]; count++
+                }
+                printf "kernel\t%s\t%.6g\t%.6g\t%.6g\t%.6g\t%.4f\n", order[k], x[1], x[2], x[3], x[4], count ? error / count : 0
+            }
+            # transfers: 2x2 least squares of CPU-DPU time on the bytes per DPU
+            det = tsum[1, 1] * tsum[2, 2] - tsum[1, 2] * tsum[1, 2]
+            t0 = det ? (ty[1] * tsum[2, 2] - tsum[1, 2] * ty[2]) / det : 0
+            t1 = det ? (tsum[1, 1] * ty[2] - tsum[1, 2] * ty[1]) / det : 0
+            printf "transfer\t%.6g\t%.6g\t%.6g\n", t0, t1, rows ? rsum / rows : 0
+        }' "${calibration}" > "${TMP_MODEL}"
+    cat "${TMP_MODEL}"
+    [ $# -eq 0 ] && return
+    # DMA cycles from the simulator logs, and the kernel model checked against their logic cycles
+    awk -v model_file="${TMP_MODEL}" -v density="${LOG_DENSITY:-0.25}" "${AWK_SOLVE}"'
+        FILENAME == model_file { if($1 == "kernel") model[$2] = $0; next }
+        FNR == 1 {
+            name = FILENAME; sub(/.*\//, "", name); sub(/\.log$/, "", name)
+            logs[++nr_logs] = name
+            nr = split(name, part, "_")
+            tasklets[name] = part[nr]
+            kernel[name] = name ~ /^pac_awq/ ? "PAC-AWQ-DP:0" : (name ~ /^pac/ ? "PAC-DP:0" : "BASELINE-DP:0")
+        }
+        {
+            split($1, key, /[][]/)
+            counter[name, key[2], substr(key[3], 2)] = $2
+            if(!((name, key[2]) in dpu_seen)) { dpu_seen[name, key[2]] = 1; dpus[name] = dpus[name] " " key[2] }
+        }
+        END {
+            reset(2)
+            for(l = 1; l <= nr_logs; l++) {
+                name = logs[l]
+                nd = split(dpus[name], ids, " ")
+                for(i = 1; i <= nd; i++) {
+                    d = ids[i]
+                    feature[1] = counter[name, d, "num_reads"] + counter[name, d, "num_writes"]
+                    feature[2] = counter[name, d, "read_bytes"] + counter[name, d, "write_bytes"]
+                    accumulate(2, feature, counter[name, d, "breakdown_dma"])
+                }
+            }
+            solve(2)
+            printf "dma\t%.6g\t%.6g\n", x[1], x[2]
+            printf "# log\tkernel\telements_dpu\tlogic_cycles\tpredicted_cycles\tdma_cycles\tpredicted_dma_cycles\n"
+            for(l = 1; l <= nr_logs; l++) {
+                name = logs[l]
+                nd = split(dpus[name], ids, " ")
+                cycles = dma = reads = bytes = 0
+                for(i = 1; i <= nd; i++) {
+                    d = ids[i]
+                    if(counter[name, d, "logic_cycle"] > cycles) cycles = counter[name, d, "logic_cycle"]
+                    dma += counter[name, d, "breakdown_dma"] / nd
+                    reads += (counter[name, d, "num_reads"] + counter[name, d, "num_writes"]) / nd
+                    bytes += (counter[name, d, "read_bytes"] + counter[name, d, "write_bytes"]) / nd
+                }
+                elements = int(bytes / 2)
+                split(model[kernel[name]], m, "\t")
+                predicted = (kernel[name] in model) ? m[3] + pipeline(tasklets[name]) * elements * (m[4] + (m[5] + m[6]) * density) : 0
+                printf "# %s\t%s\t%d\t%d\t%.0f\t%.0f\t%.0f\n", name, kernel[name], elements, cycles, predicted, dma, x[1] * reads + x[2] * bytes
+            }
+        }' FS='\t' "${TMP_MODEL}" FS=': ' "$@"
+}
+
+predict() {
+    local model=$1 kernel=$2 elements=$3 dx=$4 dw=$5 tasklets=${6:-${NR_TASKLETS:-16}} block=${7:-${BLOCK:-10}}
+    awk -F '\t' -v kernel="${kernel}" -v n="${elements}" -v dx="${dx}" -v dw="${dw}" -v tasklets="${tasklets}" -v block="${block}" \
+        "${AWK_SOLVE}"'
+        $1 == "kernel" && $2 == kernel { found = 1; cycles = $3 + pipeline(tasklets) * n * ($4 + $5 * dx + $6 * dw) }
+        $1 == "dma" { block_bytes = 2 ^ block; dmas = 2 * int((n + block_bytes - 1) / block_bytes); dma = dmas * $2 + 2 * n * $3 }
+        $1 == "transfer" { to_dpu = $2 + $3 * 2 * n; from_dpu = $4 }
+        END {
+            if(!found) { print "No model for " kernel > "/dev/stderr"; exit 1 }
+            printf "kernel\telements_dpu\tkernel_cycles\tdma_cycles\tcpu_dpu_ms\tdpu_cpu_ms\n"
+            printf "%s\t%d\t%.0f\t%.0f\t%.4f\t%.4f\n", kernel, n, cycles, dma, to_dpu, from_dpu
+        }' "${model}"
+}
+
+case "$1" in
+    calibrate) calibrate ;;
+    fit)
+        [ -f "$2" ] || { echo "usage: $0 fit calibration.tsv [sim logs...]" >&2; exit 1; }
+        TMP_MODEL=$(mktemp --suffix=.model)
+        trap 'rm -f "${TMP_MODEL}"' EXIT
+        fit "${@:2}" ;;
+    predict)
+        [ $# -ge 6 ] || { echo "usage: $0 predict model.tsv <kernel> <elements per DPU> <density x> <density w> [tasklets] [block]" >&2; exit 1; }
+        predict "${@:2}" ;;
+    *) echo "usage: $0 calibrate | fit calibration.tsv [sim logs...] | predict model.tsv <kernel> <elements per DPU> <density x> <density w> [tasklets] [block]" >&2; exit 1 ;;
+esac
@@ -0,0 +1,243 @@
+#!/bin/bash
+# Inter-layer MRAM residency planner: keeps the activations of a network in MRAM between layers where the
+# partitioning allows it, plans host-mediated copies of the rest, and accounts the transfer bytes of every layer.
+# usage: benchmarks/residency_plan.sh [resnet18|resnet50|layer table] [plan file]
+#
+# Every layer (a row of the layer table, see resnet_sweep.sh) is partitioned over the NR_DPUS DPUs by
+#   spatial : divceil(hout * wout, NR_DPUS) output pixels per DPU, all output channels
+#   channel : divceil(cout, NR_DPUS) output channels per DPU, all pixels
+# and leaves its output in MRAM in that partition, NHWC with BITS-bit activations (default 8). A DPU of the next
+# layer needs, of all input channels, the input rows of its output pixels and the halo of the kernel: rows
+# r * s - (k - 1) / 2 to (r + 1) * s + (k - 1) / 2 for output row r, with s = hin / hout folding the stride and
+# any pooling in; a channel-partitioned layer needs the whole input. The part of that its own DPU holds stays
+# resident, the rest is copied from the DPUs that hold it through the host, which reads every piece once and
+# writes it to every DPU that needs it, and a whole input is gathered once and broadcast. PARTITION (auto, spatial or channel) fixes the partition; auto takes per
+# layer, in layer order, the one that moves fewer bytes among those using at least half as many DPUs as the
+# better-balanced one.
+# Downsample layers (*.down) read the input of their block's first layer and the next layers read their output,
+# the residual sum. A layer's input is cin channels of the previous layer's hout x wout, or of the network input,
+# pushed by the host, for the first layer: hin x win from optional columns 8 and 9 of its row. The ResNet tables
+# list every layer; a row of another table may stand for repeat layers: the first reads the previous row, the
+# others (row NAME[2-repeat]) the output of the instance before them, at the row's own hout x wout without stride,
+# all in the partition of the first.
+# The baseline is today's host round trip: pull the whole output, push every DPU its slice of the next input.
+#
+# Plan file (TSV), pixel and channel ranges [first, end) of the layer's input tensor:
+#   layer     <name> <spatial|channel> <pixels or channels per DPU> <DPUs> <input: host or the producing layer>
+#   copy      <src DPU> <dst DPU> <first pixel> <end pixel> <first channel> <end channel> <bytes>
+#   gather    <src DPU> <first pixel> <end pixel> <first channel> <end channel> <bytes>
+#   broadcast <bytes>
+#   push      <dst DPU> <first pixel> <end pixel> <first channel> <end channel> <bytes>   (from the host)
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+NETWORK=${1:-resnet18}
+PLAN=${2:-/dev/null}
+LAYERS="${SCRIPT_DIR}/layers/${NETWORK}.txt"
+[ -f "${LAYERS}" ] || LAYERS="${NETWORK}"
+[ -f "${LAYERS}" ] || { echo "No layer table ${NETWORK}" >&2; exit 1; }
+case "${PARTITION:-auto}" in
+    auto|spatial|channel) ;;
+    *) echo "PARTITION is auto, spatial or channel" >&2; exit 1 ;;
+esac
+
+grep -v '^#' "${LAYERS}" | awk -v dpus="${NR_DPUS:-32}" -v bits="${BITS:-8}" -v partition="${PARTITION:-auto}" \
+    -v plan="${PLAN}" -v network="$(basename "${LAYERS}" .txt)" '
+    function divceil(n, m) { return int((n + m - 1) / m) }
+    function min(a, b) { return a < b ? a : b }
+    function max(a, b) { return a > b ? a : b }
+    function overlap(lo1, hi1, lo2, hi2) { return max(0, min(hi1, hi2) - max(lo1, lo2)) }
+    function bytes(elements) { return elements * bits / 8 }
+
+    # Partition of layer row n as scheme: units (pixels or channels) per DPU and DPUs used
+    function partition_of(n, scheme) {
+        units = scheme == "spatial" ? hout[n] * wout[n] : cout[n]
+        part_per = divceil(units, dpus)
+        part_used = divceil(units, part_per)
+    }
+
+    # Input elements DPU j of layer n needs, as the box [need_lo, need_hi) pixels x all channels
+    function need_of(n, scheme, per, j) {
+        if(scheme == "channel") {
+            need_lo = 0
+            need_hi = hin[n] * win[n]
+            return
+        }
+        first = j * per
+        end = min(first + per, hout[n] * wout[n])
+        s = max(1, int(hin[n] / hout[n]))
+        pad = int((k[n] - 1) / 2)
+        need_lo = max(0, int(first / wout[n]) * s - pad) * win[n]
+        need_hi = min(hin[n], (int((end - 1) / wout[n]) + 1) * s + pad) * win[n]
+    }
+
+    # Input elements held by DPU i of the producer of layer n, as the box [hold_lo, hold_hi) x [hold_c0, hold_c1)
+    function hold_of(n, i) {
+        p = producer[n]
+        if(scheme_of[p] == "spatial") {
+            hold_lo = i * per_of[p]
+            hold_hi = min(hold_lo + per_of[p], hin[n] * win[n])
+            hold_c0 = 0
+            hold_c1 = cin[n]
+        } else {
+            c = divceil(cin[n], used_of[p])
+            hold_lo = 0
+            hold_hi = hin[n] * win[n]
+            hold_c0 = min(i * c, cin[n])
+            hold_c1 = min(hold_c0 + c, cin[n])
+        }
+    }
+
+    # Transfer elements of layer n in scheme: sets needed, resident, moved, baseline and cost (pulled + pushed),
+    # and writes the plan entries if emit
+    function evaluate(n, scheme, emit) {
+        partition_of(n, scheme)
+        per = part_per
+        used = part_used
+        needed = resident = moved = 0
+        total = hin[n] * win[n] * cin[n]
+        for(j = 0; j < used; j++) {
+            need_of(n, scheme, per, j)
+            needed += (need_hi - need_lo) * cin[n]
+            if(emit && producer[n] < 0)
+                printf "push\t%d\t%d\t%d\t%d\t%d\t%.0f\n", j, need_lo, need_hi, 0, cin[n], bytes((need_hi - need_lo) * cin[n]) > plan
+        }
+        if(producer[n] < 0) {
+            # network input, from the host either way
+            moved = needed
+            baseline = cost = needed
+            return
+        }
+        baseline = total + needed
+        if(scheme == "channel") {
+            # every DPU needs every element: gathered from the holders, broadcast
+            moved = needed
+            cost = total + needed
+            if(emit) {
+                for(i = 0; i < used_of[producer[n]]; i++) {
+                    hold_of(n, i)
+                    if(hold_hi > hold_lo && hold_c1 > hold_c0)
+                        printf "gather\t%d\t%d\t%d\t%d\t%d\t%.0f\n", i, hold_lo, hold_hi, hold_c0, hold_c1,
+                            bytes((hold_hi - hold_lo) * (hold_c1 - hold_c0)) > plan
+                }
+                printf "broadcast\t%.0f\n", bytes(total) > plan
+            }
+            return
+        }
+        p = producer[n]
+        # pixels of every holder needed by lower and by higher DPUs: the needs rise with the DPU, so both are
+        # a range, at the start and at the end of what the holder has
+        split("", low_lo); split("", low_hi); split("", high_lo); split("", high_hi)
+        for(j = 0; j < used; j++) {
+            need_of(n, scheme, per, j)
+            if(need_hi <= need_lo)
+                continue
+            # holders whose box meets the need: a pixel range of a spatial producer, every DPU of a channel one
+            i0 = scheme_of[p] == "spatial" ? int(need_lo / per_of[p]) : 0
+            i1 = scheme_of[p] == "spatial" ? min(used_of[p] - 1, int((need_hi - 1) / per_of[p])) : used_of[p] - 1
+            for(i = i0; i <= i1; i++) {
+                hold_of(n, i)
+                box = overlap(need_lo, need_hi, hold_lo, hold_hi) * (hold_c1 - hold_c0)
+                if(box <= 0)
+                    continue
+                if(i == j) {
+                    resident += box
+                } else {
+                    moved += box
+                    lo = max(need_lo, hold_lo)
+                    hi = min(need_hi, hold_hi)
+                    if(j < i && !(i in low_lo)) {
+                        low_lo[i] = lo
+                        low_hi[i] = hi
+                    } else if(j < i) {
+                        low_lo[i] = min(low_lo[i], lo)
+                        low_hi[i] = max(low_hi[i], hi)
+                    } else if(!(i in high_lo)) {
+                        high_lo[i] = lo
+                        high_hi[i] = hi
+                    } else {
+                        high_lo[i] = min(high_lo[i], lo)
+                        high_hi[i] = max(high_hi[i], hi)
+                    }
+                    if(emit)
+                        printf "copy\t%d\t%d\t%d\t%d\t%d\t%d\t%.0f\n", i, j, max(need_lo, hold_lo), min(need_hi, hold_hi),
+                            hold_c0, hold_c1, bytes(box) > plan
+                }
+            }
+        }
+        # the host reads every piece once, from its holder, and writes it to every DPU that needs it
+        pulled = 0
+        for(i = 0; i < used_of[p]; i++) {
+            hold_of(n, i)
+            low = i in low_lo ? low_hi[i] - low_lo[i] : 0
+            high = i in high_lo ? high_hi[i] - high_lo[i] : 0
+            both = i in low_lo && i in high_lo ? overlap(low_lo[i], low_hi[i], high_lo[i], high_hi[i]) : 0
+            pulled += (low + high - both) * (hold_c1 - hold_c0)
+        }
+        cost = pulled + moved
+    }
+
+    # Partition of layer n as scheme, kept for the layers that read its output
+    function set_partition(n, scheme) {
+        partition_of(n, scheme)
+        scheme_of[n] = scheme
+        per_of[n] = part_per
+        used_of[n] = part_used
+    }
+
+    # Plans count instances of layer n as label: picks the partition (fixed, if given), writes the plan and prints the row
+    function account(n, label, count, fixed) {
+        scheme = fixed != "" ? fixed : partition
+        if(scheme == "auto") {
+            # fewer moved bytes, among the partitions that keep at least half the DPUs of the better-balanced one busy
+            set_partition(n, "spatial"); evaluate(n, "spatial", 0); spatial_cost = cost; spatial_used = used
+            set_partition(n, "channel"); evaluate(n, "channel", 0); channel_cost = cost; channel_used = used
+            best_used = max(spatial_used, channel_used)
+            if(2 * channel_used < best_used)
+                scheme = "spatial"
+            else if(2 * spatial_used < best_used)
+                scheme = "channel"
+            else
+                scheme = channel_cost < spatial_cost ? "channel" : "spatial"
+        }
+        set_partition(n, scheme)
+        printf "layer\t%s\t%s\t%d\t%d\t%s\n", label, scheme, part_per, part_used, producer[n] < 0 ? "host" : name[producer[n]] > plan
+        evaluate(n, scheme, 1)
+
+        printf "%s\t%d\t%s\t%d\t%s\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.3f\n", label, count, scheme, used,
+            producer[n] < 0 ? "host" : (scheme == "channel" ? "gather" : (moved ? "shuffle" : "resident")), bytes(needed), bytes(resident),
+            bytes(moved), bytes(baseline), bytes(cost), (baseline > 0 ? 1 - cost / baseline : 0)
+        net_needed += count * needed; net_resident += count * resident; net_moved += count * moved
+        net_baseline += count * baseline; net_cost += count * cost
+    }
+
+    NF >= 7 {
+        n = rows++
+        name[n] = $1; cin[n] = $2; cout[n] = $3; k[n] = $4; hout[n] = $5; wout[n] = $6; repeat[n] = $7
+        # block of the layer: the name up to its last dot, whose first layer reads the block input
+        block = $1
+        sub(/\.[^.]*$/, "", block)
+        if(!(block in block_input))
+            block_input[block] = last
+        producer[n] = $1 ~ /\.down$/ ? block_input[block] : last
+        # the network input has the resolution of columns 8 and 9, or of the layer output without them
+        hin[n] = producer[n] >= 0 ? hout[producer[n]] : (NF >= 9 ? $8 : hout[n])
+        win[n] = producer[n] >= 0 ? wout[producer[n]] : (NF >= 9 ? $9 : wout[n])
+        account(n, name[n], 1, "")
+        # the other instances read the output of the previous one, at the resolution of the row, and keep the
+        # partition of the first, which is the layout they read
+        if(repeat[n] > 1) {
+            producer[n] = n
+            hin[n] = hout[n]
+            win[n] = wout[n]
+            account(n, name[n] "[2-" repeat[n] "]", repeat[n] - 1, scheme_of[n])
+        }
+        last = n
+    }
+    BEGIN {
+        last = -1
+        printf "layer\trepeat\tpartition\tdpus\tinput\tinput_bytes\tresident_bytes\tmoved_bytes\tbaseline_bytes\tplan_bytes\tsaved\n"
+    }
+    END {
+        printf "\nnetwork\tdpus\tinput_bytes\tresident_bytes\tmoved_bytes\tbaseline_bytes\tplan_bytes\tsaved\n"
+        printf "%s\t%d\t%.0f\t%.0f\t%.0f\t%.0f\t%.0f\t%.3f\n", network, dpus, bytes(net_needed), bytes(net_resident),
+            bytes(net_moved), bytes(net_baseline), bytes(net_cost), (net_baseline > 0 ? 1 - net_cost / net_baseline : 0)
+    }'
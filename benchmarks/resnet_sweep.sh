@@ -0,0 +1,78 @@
+#!/bin/bash
+# Per-layer and whole-network latency of ResNet-18/50 on the baseline, PAC and PAC-AWQ kernels.
+# Speedups are relative to the fastest exact kernel, the native-multiply baseline (BASELINE-DP -k 1).
+# usage: benchmarks/resnet_sweep.sh [resnet18|resnet50|layer table] [scale]
+# Every layer runs as cout*hout*wout*cin*k*k multiply-accumulates, divided by scale (default 1) to shorten
+# simulated runs. The activations are sent once per output channel, so the transfer share is an upper bound.
+# Latency is CPU-DPU + DPU kernel + DPU-CPU time, or streamed + DPU-CPU time for layers larger than the MRAM,
+# whose pushes overlap the kernels: their transfer share, and the network's then, is n/a. NR_DPUS, NR_TASKLETS,
+# BLOCK, GEN (input generator, default relu) and REPS (timed repetitions, default 3) are taken from the environment.
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+ROOT="${SCRIPT_DIR}/.."
+NETWORK=${1:-resnet18}
+SCALE=${2:-1}
+LAYERS="${SCRIPT_DIR}/layers/${NETWORK}.txt"
+[ -f "${LAYERS}" ] || LAYERS="${NETWORK}"
+[ -f "${LAYERS}" ] || { echo "No layer table ${NETWORK}" >&2; exit 1; }
+MAKE_VARS="NR_DPUS=${NR_DPUS:-32} NR_TASKLETS=${NR_TASKLETS:-16} BLOCK=${BLOCK:-10}"
+KERNELS=(BASELINE-DP:1 BASELINE-DP:0 BASELINE-DP:2 PAC-DP:0 PAC-AWQ-DP:0) # benchmark directory:kernel index (-k), reference first
+
+for kernel in "${KERNELS[@]}"; do
+    make -s -C "${ROOT}/${kernel%:*}" ${MAKE_VARS} > /dev/null || exit 1
+done
+
+# time (ms) of one timer from the host output
+timer_ms() {
+    echo "$1" | grep -o "$2 Time (ms): [0-9.]*" | awk '{ print $NF }'
+}
+
+# host output per kernel and layer size, layers of the same shape run once
+declare -A runs
+printf "layer\trepeat\tK\toutputs\tkernel\tlatency_ms\ttransfer_share\tspeedup\tstatus\n"
+rows=$(grep -v '^#' "${LAYERS}" | while read -r name cin cout k hout wout repeat _; do
+    [ -z "${name}" ] && continue
+    K=$((cin * k * k))
+    outputs=$((cout * hout * wout))
+    elements=$(( (K * outputs + SCALE - 1) / SCALE ))
+    for kernel in "${KERNELS[@]}"; do
+        run="${kernel} ${elements}"
+        [ -z "${runs[${run}]+x}" ] && runs[${run}]=$(cd "${ROOT}/${kernel%:*}" && ./bin/host_code -w 1 -e "${REPS:-3}" -k "${kernel#*:}" -i "${elements}" -g "${GEN:-relu}")
+        out=${runs[${run}]}
+        to_dpu=$(timer_ms "${out}" "CPU-DPU")
+        dpu=$(timer_ms "${out}" "DPU Kernel")
+        from_dpu=$(timer_ms "${out}" "DPU-CPU")
+        streamed=$(timer_ms "${out}" "Streamed")
+        status=$(echo "${out}" | grep -q "Outputs are equal" && echo OK || echo ERROR)
+        if [ -n "${streamed}" ]; then
+            latency=$(awk -v s="${streamed}" -v c="${from_dpu}" 'BEGIN { printf "%.4f", s + c }')
+            share=n/a
+        else
+            latency=$(awk -v a="${to_dpu}" -v b="${dpu}" -v c="${from_dpu}" 'BEGIN { printf "%.4f", a + b + c }')
+            share=$(awk -v a="${to_dpu}" -v c="${from_dpu}" -v l="${latency}" 'BEGIN { printf "%.3f", (l > 0 ? (a + c) / l : 0) }')
+        fi
+        [ "${kernel}" = "${KERNELS[0]}" ] && baseline=${latency}
+        speedup=$(awk -v b="${baseline}" -v l="${latency}" 'BEGIN { printf "%.2f", (l > 0 ? b / l : 0) }')
+        printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "${name}" "${repeat}" "${K}" "${outputs}" "${kernel}" \
+            "${latency}" "${share}" "${speedup}" "${status}"
+    done
+done)
+echo "${rows}"
+
+# Whole network: layers weighted by their repeat count
+echo "${rows}" | awk -F '\t' -v network="$(basename "${LAYERS}" .txt)" '
+    {
+        latency[$5] += $2 * $6
+        transfer[$5] += $2 * $6 * $7
+        if($7 == "n/a") streamed[$5] = 1
+        if(!($5 in seen)) { seen[$5] = 1; order[++n] = $5 }
+    }
+    END {
+        printf "\nnetwork\tkernel\tlatency_ms\ttransfer_share\tspeedup\n"
+        for(i = 1; i <= n; i++) {
+            k = order[i]
+            if(k in streamed) share = "n/a"
+            else share = sprintf("%.3f", (latency[k] > 0 ? transfer[k] / latency[k] : 0))
+            printf "%s\t%s\t%.4f\t%s\t%.2f\n", network, k, latency[k], share,
+                (latency[k] > 0 ? latency[order[1]] / latency[k] : 0)
+        }
+    }'
@@ -0,0 +1,59 @@
+#!/bin/bash
+# Strong and weak scaling of the baseline, PAC and PAC-AWQ kernels over the number of DPUs.
+# usage: benchmarks/scaling.sh [total size] [size per DPU]
+# Strong scaling keeps the total input size fixed (default 67108864 elements), weak scaling the size per DPU
+# (default 1048576 elements). Every DPU count is a separate build (NR_DPUS), the host code is unchanged, so the
+# transfers go through the same DPU_FOREACH paths. DPUS (the counts to run, the first one is the reference for
+# the parallel efficiency), NR_TASKLETS, BLOCK, GEN (input generator, default relu) and REPS (timed repetitions,
+# default 3) are taken from the environment. With DEVICE_SEED set, the DPUs generate the operands themselves
+# (-d, kernel-only runs without operand transfers), which needs every input to fit in one MRAM wave.
+# Inputs larger than the MRAM of the DPUs are streamed in waves whose pushes overlap the kernels: those runs
+# only have a streamed time, printed as cpu_dpu_ms with kernel_ms and the kernel efficiency n/a.
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+ROOT="${SCRIPT_DIR}/.."
+STRONG_SIZE=${1:-67108864}
+WEAK_SIZE=${2:-1048576}
+DPUS=${DPUS:-"1 2 4 8 16 32 64 128 256 512 1024 2048 2560"}
+DPUS_PER_RANK=64
+
+# time (ms) of one timer from the host output
+timer_ms() {
+    echo "$1" | grep -o "$2 Time (ms): [0-9.]*" | awk '{ print $NF }'
+}
+
+# parallel efficiency against the reference run: T(ref) * ref_dpus / (T * dpus) for strong, T(ref) / T for weak scaling
+efficiency() {
+    awk -v ref="$1" -v t="$2" -v n0="$3" -v n="$4" -v mode="$5" \
+        'BEGIN { if(ref == "n/a" || t == "n/a") { print "n/a"; exit } e = (t > 0) ? ref / t : 0; if(mode == "strong") e = e * n0 / n; printf "%.3f", e }'
+}
+
+printf "kernel\tmode\tdpus\tranks\telements\tcpu_dpu_ms\tkernel_ms\tdpu_cpu_ms\treduction_ms\ttotal_ms\tkernel_efficiency\tefficiency\tstatus\n"
+# benchmark directory:kernel index (-k)
+for kernel in BASELINE-DP:0 BASELINE-DP:1 BASELINE-DP:2 PAC-DP:0 PAC-AWQ-DP:0; do
+    for mode in strong weak; do
+        ref_dpus=
+        for dpus in ${DPUS}; do
+            make -s -C "${ROOT}/${kernel%:*}" NR_DPUS=${dpus} NR_TASKLETS=${NR_TASKLETS:-16} BLOCK=${BLOCK:-10} > /dev/null || exit 1
+            [ "${mode}" = "strong" ] && elements=${STRONG_SIZE} || elements=$((WEAK_SIZE * dpus))
+            out=$(cd "${ROOT}/${kernel%:*}" && ./bin/host_code -w 1 -e "${REPS:-3}" -k "${kernel#*:}" -i "${elements}" -g "${GEN:-relu}" ${DEVICE_SEED:+-d ${DEVICE_SEED}})
+            to_dpu=$(timer_ms "${out}" "CPU-DPU")
+            dpu=$(timer_ms "${out}" "DPU Kernel")
+            from_dpu=$(timer_ms "${out}" "DPU-CPU")
+            streamed=$(timer_ms "${out}" "Streamed")
+            [ -n "${streamed}" ] && { to_dpu=${streamed}; dpu=n/a; }
+            reduction=$(timer_ms "${out}" "Host reduction")
+            status=$(echo "${out}" | grep -q "Outputs are equal" && echo OK || echo ERROR)
+            total=$(awk -v a="${to_dpu}" -v b="${dpu}" -v c="${from_dpu}" -v d="${reduction}" 'BEGIN { printf "%.4f", a + b + c + d }')
+            if [ -z "${ref_dpus}" ]; then
+                ref_dpus=${dpus}
+                ref_kernel=${dpu}
+                ref_total=${total}
+            fi
+            printf "%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\t%s\n" "${kernel}" "${mode}" "${dpus}" \
+                $(( (dpus + DPUS_PER_RANK - 1) / DPUS_PER_RANK )) "${elements}" "${to_dpu}" "${dpu}" "${from_dpu}" \
+                "${reduction}" "${total}" \
+                "$(efficiency "${ref_kernel}" "${dpu}" "${ref_dpus}" "${dpus}" "${mode}")" \
+                "$(efficiency "${ref_total}" "${total}" "${ref_dpus}" "${dpus}" "${mode}")" "${status}"
+        done
+    done
+done
@@ -0,0 +1,29 @@
+#!/bin/bash
+# Summarize cycle-accurate simulator logs (Cycle_accurate_sim_log/*.log), e.g. to compare SCHED modes.
+# usage: benchmarks/sim_log_summary.sh <log>...
+# Counters are averaged over the DPUs of a log, except cycles and instructions (slowest DPU).
+# active_tasklets is the fraction of logic cycles with 0, 1, 2, ... tasklets active.
+printf "log\tdpus\tlogic_cycles\tinstructions\trow_activations\trow_precharges\tread_bytes\tbytes_per_activation\tactive_tasklets\n"
+for log in "$@"; do
+    awk -F ': ' -v log_name="$(basename "${log}" .log)" '
+        {
+            split($1, key, /[][]/)
+            dpu = key[2]
+            counter = substr(key[3], 2)
+            if(!(dpu in dpus)) { dpus[dpu] = 1; nr_dpus++ }
+            sum[counter] += $2
+            if($2 > max[counter]) max[counter] = $2
+            if(counter ~ /^active_tasklets_/) {
+                t = substr(counter, 17) + 0
+                if(t > max_tasklets) max_tasklets = t
+            }
+        }
+        END {
+            histogram = ""
+            for(t = 0; t <= max_tasklets; t++)
+                histogram = histogram (t ? "," : "") sprintf("%.3f", sum["logic_cycle"] ? sum["active_tasklets_" t] / sum["logic_cycle"] : 0)
+            printf "%s\t%d\t%d\t%d\t%.1f\t%.1f\t%.1f\t%.1f\t%s\n", log_name, nr_dpus, max["logic_cycle"], max["num_instructions"],
+                sum["num_activations"] / nr_dpus, sum["num_precharges"] / nr_dpus, sum["read_bytes"] / nr_dpus,
+                (sum["num_activations"] ? sum["read_bytes"] / sum["num_activations"] : 0), histogram
+        }' "${log}"
+done
@@ -0,0 +1,82 @@
+#!/bin/bash
+# Fastest PAC threshold and PAC-AWQ exact ratio/threshold per layer that meet a relative-error budget.
+# usage: benchmarks/tune_pac.sh <relative error budget> [sample ...]
+# A sample is one layer: a tensor file written with -o for NR_DPUS DPUs, or ACT:WEIGHT raw 8-bit dumps
+# (run over their length). Without samples the layer is SIZE (default 262144) elements of the GEN generator
+# (default relu). Every candidate runs on the generic kernels with PERF=CYCLES; its error is the host's
+# rel_error against the exact dot product. Prints every candidate, then the fastest setting per layer and
+# kernel within the budget. NR_DPUS, NR_TASKLETS, BLOCK, ENCODING (-q, default uu), BITS (-b, default 8),
+# RATIOS (exact shares tried by PAC-AWQ) and REPS (timed repetitions, default 3) are taken from the environment.
+# The generic kernels process all 8 bit planes at any element width, so the thresholds run from 0 to 8. Tensor
+# files carry their own encoding and element width, so ENCODING and BITS do not apply to them.
+SCRIPT_DIR=$( cd -- "$( dirname -- "${BASH_SOURCE[0]}" )" &> /dev/null && pwd )
+ROOT="${SCRIPT_DIR}/.."
+BUDGET=${1:?relative error budget}
+shift
+if [ -n "${BITS}${ENCODING}" ]; then
+    for sample in "$@"; do
+        if [ "${sample#*:}" = "${sample}" ]; then
+            echo "${sample} is a tensor file: its encoding and element width come from its header, unset ENCODING and BITS" >&2
+            exit 1
+        fi
+    done
+fi
+BITS=${BITS:-8}
+PLANES=$(awk '$1 == "#define" && $2 == "P_BITS" { print $3 }' "${ROOT}/PAC-DP/host/app.c") # Bit planes of -k 0
+RATIOS=${RATIOS:-"0 0.05 0.1 0.2 0.3"}
+MAKE_VARS="NR_DPUS=${NR_DPUS:-32} NR_TASKLETS=${NR_TASKLETS:-16} BLOCK=${BLOCK:-10} PERF=CYCLES"
+SAMPLES=("$@")
+[ ${#SAMPLES[@]} -eq 0 ] && SAMPLES=("-")
+
+for bench in PAC-DP PAC-AWQ-DP; do
+    make -s -C "${ROOT}/${bench}" ${MAKE_VARS} > /dev/null || exit 1
+done
+
+# host arguments of a sample
+sample_args() {
+    if [ "$1" = "-" ]; then
+        echo "-i ${SIZE:-262144} -g ${GEN:-relu} -q ${ENCODING:-uu} -b ${BITS}"
+    elif [ "${1#*:}" != "$1" ]; then
+        echo "-i $(stat -c %s "${1%%:*}") -g dump -x $(realpath "${1%%:*}") -y $(realpath "${1#*:}") -q ${ENCODING:-uu} -b ${BITS}"
+    else
+        echo "-f $(realpath "$1")"
+    fi
+}
+
+# one candidate: benchmark directory, layer, setting (host -t argument)
+run() {
+    out=$(cd "${ROOT}/$1" && ./bin/host_code -w 1 -e "${REPS:-3}" -k 0 ${ARGS} -t "$3")
+    cycles=$(echo "${out}" | awk '/^DPU cycles/ { print $4 }')
+    error=$(echo "${out}" | awk '/^rel_error/ { print $2 }')
+    status=$(echo "${out}" | grep -q "Outputs are equal" && echo OK || echo ERROR)
+    printf "%s\t%s\t%s\t%s\t%s\t%s\n" "$2" "$1" "$3" "${cycles}" "${error}" "${status}"
+}
+
+printf "layer\tkernel\tsetting\tdpu_cycles\trel_error\tstatus\n"
+rows=$(for sample in "${SAMPLES[@]}"; do
+    layer=$(basename "${sample%%:*}")
+    ARGS=$(sample_args "${sample}")
+    for threshold in $(seq 0 "${PLANES}"); do
+        run PAC-DP "${layer}" "${threshold}"
+    done
+    # an exact tier of the most salient elements, the rest at one threshold
+    for ratio in ${RATIOS}; do
+        for threshold in $(seq 1 "${PLANES}"); do
+            run PAC-AWQ-DP "${layer}" "$(awk -v r="${ratio}" -v t="${threshold}" 'BEGIN { printf "%s:0,%g:%d", r, 1 - r, t }')"
+        done
+    done
+done)
+echo "${rows}"
+
+# Fastest candidate per layer and kernel within the budget
+echo "${rows}" | awk -F '\t' -v budget="${BUDGET}" '
+    $6 == "OK" && $5 <= budget {
+        key = $1 "\t" $2
+        if(!(key in best) || $4 < cycles[key]) { best[key] = $3; cycles[key] = $4; error[key] = $5 }
+        if(!(key in seen)) { seen[key] = 1; order[++n] = key }
+    }
+    END {
+        printf "\nlayer\tkernel\tbest_setting\tdpu_cycles\trel_error\n"
+        for(i = 1; i <= n; i++)
+            printf "%s\t-t %s\t%s\t%s\n", order[i], best[order[i]], cycles[order[i]], error[order[i]]
+    }'